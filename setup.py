@@ -1,16 +1,24 @@
 import os
+import numpy
 from distutils.core import setup, Extension
-from distutils.sysconfig import get_python_lib
 
-incdir = os.path.join(get_python_lib(plat_specific=1),
-                      "numpy/core/include/numpy")
+incdir = os.path.join(numpy.get_include(), "numpy")
 
 odbparser = Extension('odbparser',
                     sources=["src/odb_io.c",
                              "src/odb_io_f.c",
+                             "src/odb_write_f.c",
+                             "src/odb_pdb.c",
+                             "src/odb_geom.c",
+                             "src/odb_shm.c",
+                             "src/odb_diff.c",
+                             "src/odb_pool.c",
+                             "src/odb_verify.c",
                              "src/odbparsermodule.c",
                              ],
-                    include_dirs=[incdir])
+                    libraries=['rt', 'pthread'],
+                    define_macros=[('_FILE_OFFSET_BITS', '64')],
+                    include_dirs=[incdir, numpy.get_include()])
 
 setup(name='odbparser',
       version='2.0',
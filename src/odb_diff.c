@@ -0,0 +1,306 @@
+/*
+   Compare the datablocks of two O files, binary or formatted.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+
+   The datablocks are compared a chunk at a time, so memory use does
+   not depend on the size of the files. Chunks whose bytes are equal
+   are not decoded further. Text datablocks are read completely.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <math.h>
+#include "odb_io.h"
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#  include <emmintrin.h>
+#  define USE_SSE 1
+#else
+#  define USE_SSE 0
+#endif
+
+#define DIFF_CHUNK 65536	/* number of elements compared at a time */
+
+/*
+  Open an O file and find its datablocks.
+*/
+int odb_open (char *fnam, int binary, odb_file *f)
+{
+  memset (f, 0, sizeof(odb_file));
+  f->binary = binary;
+  f->fd = -1;
+  if (binary)
+    f->blocks = scan_binary_file (fnam, &f->nblocks);
+  else
+    f->blocks = scan_formatted_file (fnam, &f->nblocks);
+  if (f->nblocks < 0)
+    return -1;
+  if (binary)
+    f->fd = open (fnam, O_RDONLY);
+  else
+    f->fp = fopen (fnam, "r");
+  if (f->fd < 0 && !f->fp) {
+    free (f->blocks);
+    return -1;
+  }
+  return 0;
+}
+
+void odb_close (odb_file *f)
+{
+  free (f->blocks);
+  if (f->fd >= 0)
+    close (f->fd);
+  if (f->fp)
+    fclose (f->fp);
+}
+
+/*
+  Read elements 'i' to 'i+n' of datablock 'e'. Data from a binary file
+  are not byte swapped. In a formatted file the chunks must be read in
+  order, and a chunk of a type C datablock must end at the end of a
+  line; read_c6_f then leaves the file at the start of the next.
+*/
+static int read_chunk (odb_file *f, odb_entry *e, int64_t i, int64_t n, char *buf)
+{
+  int64_t w = e->typ == 'C' ? 6 : 4;
+
+  if (f->binary)
+    return pread_record (f->fd, e->src, buf, w*i, w*n, DOSWAP) == w*n ? 0 : -1;
+
+  if (i == 0 && fseeko (f->fp, e->src, SEEK_SET) < 0)
+    return -1;
+  switch (e->typ) {
+  case 'I':
+    return read_int4_f (f->fp, (int *)buf, n);
+  case 'R':
+    return read_float4_f (f->fp, (float *)buf, n);
+  case 'C':
+    return read_c6_f (f->fp, buf, n, e->fmt);
+  }
+  return -1;
+}
+
+/*
+  Count the reals that differ. Two reals are equal if they are
+  identical, or if |a - b| <= atol + rtol*|b|.
+*/
+static int64_t count_real (const float *a, const float *b, int64_t n, float rtol, float atol)
+{
+  register int64_t i = 0;
+  int64_t count = 0;
+
+#if USE_SSE
+  static const char nbits[16] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4};
+  __m128 va, vb, ok, sign, vr, vt;
+  __m128i same;
+
+  sign = _mm_set1_ps(-0.0f);
+  vr = _mm_set1_ps(rtol);
+  vt = _mm_set1_ps(atol);
+  for (; i+4 <= n; i+=4) {
+    va = _mm_loadu_ps(a+i);
+    vb = _mm_loadu_ps(b+i);
+    ok = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(va, vb)),
+		      _mm_add_ps(vt, _mm_mul_ps(vr, _mm_andnot_ps(sign, vb))));
+    same = _mm_cmpeq_epi32(_mm_castps_si128(va), _mm_castps_si128(vb));
+    count += 4 - nbits[_mm_movemask_ps(_mm_or_ps(ok, _mm_castsi128_ps(same)))];
+  }
+#endif
+  for (; i<n; i++)
+    if (!(fabsf(a[i] - b[i]) <= atol + rtol*fabsf(b[i])) && memcmp(&a[i], &b[i], 4))
+      count++;
+  return count;
+}
+
+/*
+  Count the integers that differ, with the same tolerance as reals.
+*/
+static int64_t count_int (const int *a, const int *b, int64_t n, double rtol, double atol)
+{
+  register int64_t i;
+  int64_t count = 0;
+
+  if (rtol == 0 && atol == 0) {
+    for (i=0; i<n; i++)
+      count += a[i] != b[i];
+  } else {
+    for (i=0; i<n; i++)
+      count += !(fabs((double)a[i] - b[i]) <= atol + rtol*fabs((double)b[i]));
+  }
+  return count;
+}
+
+static int64_t count_c6 (const char *a, const char *b, int64_t n)
+{
+  register int64_t i;
+  int64_t count = 0;
+
+  for (i=0; i<n; i++)
+    count += memcmp(a+6*i, b+6*i, 6) != 0;
+  return count;
+}
+
+/*
+  Read a text datablock and split it into lines, with trailing spaces
+  stripped. Returns an array of pointers to the lines, which are
+  stored in the same allocation, or NULL on error.
+*/
+static char **text_lines (odb_file *f, odb_entry *e, int64_t *nlines)
+{
+  register int64_t i;
+  int64_t n, len;
+  char **lines, *buf, *s, *ch;
+
+  if (f->binary) {
+    buf = malloc (e->nbytes + 1);
+    if (!buf)
+      return NULL;
+    if (pread_record (f->fd, e->src, buf, 0, e->nbytes, DOSWAP) != e->nbytes) {
+      free (buf);
+      return NULL;
+    }
+    for (i=0, n=0; i < e->nbytes; i++)
+      n += buf[i] == '\r';
+    len = e->nbytes + 1;
+  } else {
+    n = e->size;
+    len = n * (e->reclen + 1);
+    buf = NULL;
+  }
+
+  lines = malloc (n * sizeof(char *) + len);
+  if (!lines) {
+    free (buf);
+    return NULL;
+  }
+  s = (char *)(lines + n);
+
+  if (f->binary) {
+    memcpy (s, buf, e->nbytes);
+    free (buf);
+    for (i=0, ch=s; i < n; i++) {
+      lines[i] = ch;
+      while (*ch != '\r')
+	ch++;
+      *ch++ = '\0';
+    }
+  } else {
+    if (fseeko (f->fp, e->src, SEEK_SET) < 0
+	|| read_text_f (f->fp, s, n, e->reclen) < n * e->reclen) {
+      free (lines);
+      return NULL;
+    }
+    // spread the records out, leaving room for a terminating zero
+    for (i=n-1; i >= 0; i--) {
+      lines[i] = s + i*(e->reclen + 1);
+      memmove (lines[i], s + i*e->reclen, e->reclen);
+      lines[i][e->reclen] = '\0';
+    }
+  }
+
+  for (i=0; i < n; i++) {
+    ch = lines[i] + strlen(lines[i]);
+    while (ch > lines[i] && (unsigned char)ch[-1] <= 32)
+      *--ch = '\0';
+  }
+  *nlines = n;
+  return lines;
+}
+
+static int64_t diff_text (odb_file *a, odb_entry *ea, odb_file *b, odb_entry *eb)
+{
+  register int64_t i;
+  int64_t na, nb, count;
+  char **la, **lb;
+
+  la = text_lines (a, ea, &na);
+  if (!la)
+    return -1;
+  lb = text_lines (b, eb, &nb);
+  if (!lb) {
+    free (la);
+    return -1;
+  }
+  count = na > nb ? na - nb : nb - na;
+  for (i=0; i < na && i < nb; i++)
+    count += strcmp (la[i], lb[i]) != 0;
+  free (la);
+  free (lb);
+  return count;
+}
+
+/*
+  Return the number of elements of datablock 'ea' in file 'a' that
+  differ from datablock 'eb' in file 'b', or -1 on error. Elements
+  beyond the end of the shorter datablock count as different, and
+  if the types differ, all elements do. For text datablocks the
+  elements are lines.
+*/
+int64_t diff_block (odb_file *a, odb_entry *ea, odb_file *b, odb_entry *eb,
+		    double rtol, double atol)
+{
+  int64_t i, k, n, w, chunk, count, pa = 1, pb = 1;
+  char *bufa, *bufb;
+
+  if (ea->typ != eb->typ)
+    return ea->size > eb->size ? ea->size : eb->size;
+  if (ea->typ == 'T')
+    return diff_text (a, ea, b, eb);
+
+  n = ea->size < eb->size ? ea->size : eb->size;
+  count = ea->size - n + eb->size - n;
+  w = ea->typ == 'C' ? 6 : 4;
+
+  // chunks of type C datablocks must hold whole lines in both files
+  chunk = DIFF_CHUNK;
+  if (ea->typ == 'C') {
+    if (!a->binary)
+      pa = c6_per_line_f (ea->fmt);
+    if (!b->binary)
+      pb = c6_per_line_f (eb->fmt);
+    if (pa == 0 || pb == 0)
+      return -1;
+    chunk = chunk/(pa*pb) > 0 ? chunk/(pa*pb)*(pa*pb) : pa*pb;
+  }
+
+  bufa = malloc (w*chunk);
+  bufb = malloc (w*chunk);
+  for (i=0; i<n && bufa && bufb; i+=k) {
+    k = n - i < chunk ? n - i : chunk;
+    if (read_chunk (a, ea, i, k, bufa) || read_chunk (b, eb, i, k, bufb)) {
+      count = -1;
+      break;
+    }
+    if (a->binary == b->binary && memcmp (bufa, bufb, w*k) == 0)
+      continue;
+    if (w == 4 && DOSWAP) {
+      if (a->binary)
+	swap4 (bufa, k);
+      if (b->binary)
+	swap4 (bufb, k);
+    }
+    if (ea->typ == 'R')
+      count += count_real ((float *)bufa, (float *)bufb, k, rtol, atol);
+    else if (ea->typ == 'I')
+      count += count_int ((int *)bufa, (int *)bufb, k, rtol, atol);
+    else
+      count += count_c6 (bufa, bufb, k);
+  }
+  if (!bufa || !bufb)
+    count = -1;
+  free (bufa);
+  free (bufb);
+  return count;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
@@ -0,0 +1,286 @@
+/*
+   Geometry kernels working directly on O coordinate arrays, which
+   hold single precision x,y,z triplets.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "odb_io.h"
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#  include <emmintrin.h>
+#  define USE_SSE 1
+#  define SHUF(a,b,c,d) _MM_SHUFFLE(d,c,b,a)
+
+/*
+  Four points x,y,z in three registers are transposed to three
+  registers holding x, y and z of the four points, and back.
+*/
+static void aos_to_soa (__m128 a, __m128 b, __m128 c, __m128 *x, __m128 *y, __m128 *z)
+{
+  *x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, SHUF(0,0,3,3)),
+		      _mm_shuffle_ps(b, c, SHUF(2,2,1,1)), SHUF(0,2,0,2));
+  *y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, SHUF(1,1,0,0)),
+		      _mm_shuffle_ps(b, c, SHUF(3,3,2,2)), SHUF(0,2,0,2));
+  *z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, SHUF(2,2,1,1)),
+		      _mm_shuffle_ps(c, c, SHUF(0,0,3,3)), SHUF(0,2,0,2));
+}
+
+static void soa_to_aos (__m128 x, __m128 y, __m128 z, __m128 *a, __m128 *b, __m128 *c)
+{
+  *a = _mm_shuffle_ps(_mm_shuffle_ps(x, y, SHUF(0,0,0,0)),
+		      _mm_shuffle_ps(z, x, SHUF(0,0,1,1)), SHUF(0,2,0,2));
+  *b = _mm_shuffle_ps(_mm_shuffle_ps(y, z, SHUF(1,1,1,1)),
+		      _mm_shuffle_ps(x, y, SHUF(2,2,2,2)), SHUF(0,2,0,2));
+  *c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, SHUF(2,2,3,3)),
+		      _mm_shuffle_ps(y, z, SHUF(3,3,3,3)), SHUF(0,2,0,2));
+}
+#else
+#  define USE_SSE 0
+#endif
+
+/*
+  Apply the 4x4 matrix 'mat' to 'n' points in place. The matrix is in
+  column major (OpenGL) order, the layout of .gs_real[4:20], so that
+  x' = mat[0]*x + mat[4]*y + mat[8]*z + mat[12] and so on. If 'swap'
+  is set, the coordinates are byte swapped first, so a coordinate
+  datablock can be decoded and transformed in one pass.
+*/
+void xyz_transform (float *xyz, int64_t n, const float *mat, int swap)
+{
+  register int64_t i = 0;
+  float x, y, z;
+
+#if USE_SSE
+  __m128 m[12], a, b, c, px, py, pz, rx, ry, rz;
+
+  for (i=0; i < 12; i++)
+    m[i] = _mm_set1_ps(mat[i + i/3]);	// skip the fourth row
+  for (i=0; i+4 <= n; i+=4) {
+    if (swap)
+      swap4 ((char *)&xyz[3*i], 12);
+    a = _mm_loadu_ps(&xyz[3*i]);
+    b = _mm_loadu_ps(&xyz[3*i+4]);
+    c = _mm_loadu_ps(&xyz[3*i+8]);
+    aos_to_soa (a, b, c, &px, &py, &pz);
+    rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], px), _mm_mul_ps(m[3], py)),
+		    _mm_add_ps(_mm_mul_ps(m[6], pz), m[9]));
+    ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], px), _mm_mul_ps(m[4], py)),
+		    _mm_add_ps(_mm_mul_ps(m[7], pz), m[10]));
+    rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], px), _mm_mul_ps(m[5], py)),
+		    _mm_add_ps(_mm_mul_ps(m[8], pz), m[11]));
+    soa_to_aos (rx, ry, rz, &a, &b, &c);
+    _mm_storeu_ps(&xyz[3*i], a);
+    _mm_storeu_ps(&xyz[3*i+4], b);
+    _mm_storeu_ps(&xyz[3*i+8], c);
+  }
+#endif
+  for (; i < n; i++) {
+    if (swap)
+      swap4 ((char *)&xyz[3*i], 3);
+    x = xyz[3*i];
+    y = xyz[3*i+1];
+    z = xyz[3*i+2];
+    xyz[3*i]   = mat[0]*x + mat[4]*y + mat[8]*z + mat[12];
+    xyz[3*i+1] = mat[1]*x + mat[5]*y + mat[9]*z + mat[13];
+    xyz[3*i+2] = mat[2]*x + mat[6]*y + mat[10]*z + mat[14];
+  }
+}
+
+/*
+  Add the four single precision values of 'x' to the double precision
+  sums 'lo' (lanes 0 and 1) and 'hi' (lanes 2 and 3).
+*/
+#if USE_SSE
+static void add_pd (__m128 x, __m128d *lo, __m128d *hi)
+{
+  *lo = _mm_add_pd(*lo, _mm_cvtps_pd(x));
+  *hi = _mm_add_pd(*hi, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+}
+#endif
+
+/*
+  Compute the centroid and bounding box of 'n' points. The sums are
+  accumulated in double precision, so the centroid of a large
+  molecule is as accurate as its coordinates.
+*/
+void xyz_extent (const float *xyz, int64_t n, double *centroid, float *lo, float *hi)
+{
+  register int64_t i = 0;
+  int j;
+  double sum[3] = {0.0, 0.0, 0.0};
+
+  for (j=0; j < 3; j++) {
+    lo[j] = n > 0 ? FLT_MAX : 0.0;
+    hi[j] = n > 0 ? -FLT_MAX : 0.0;
+  }
+
+#if USE_SSE
+  {
+    __m128 a, b, c, px, py, pz;
+    __m128d s[6];
+    __m128 lx = _mm_set1_ps(FLT_MAX), ly = lx, lz = lx;
+    __m128 hx = _mm_set1_ps(-FLT_MAX), hy = hx, hz = hx;
+    float t[4];
+    double d[2];
+    int k;
+
+    for (k=0; k < 6; k++)
+      s[k] = _mm_setzero_pd();
+    for (; i+4 <= n; i+=4) {
+      a = _mm_loadu_ps(&xyz[3*i]);
+      b = _mm_loadu_ps(&xyz[3*i+4]);
+      c = _mm_loadu_ps(&xyz[3*i+8]);
+      aos_to_soa (a, b, c, &px, &py, &pz);
+      add_pd (px, &s[0], &s[1]);
+      add_pd (py, &s[2], &s[3]);
+      add_pd (pz, &s[4], &s[5]);
+      lx = _mm_min_ps(lx, px);
+      ly = _mm_min_ps(ly, py);
+      lz = _mm_min_ps(lz, pz);
+      hx = _mm_max_ps(hx, px);
+      hy = _mm_max_ps(hy, py);
+      hz = _mm_max_ps(hz, pz);
+    }
+    for (j=0; j < 3; j++) {
+      _mm_storeu_pd(d, _mm_add_pd(s[2*j], s[2*j+1]));
+      sum[j] = d[0] + d[1];
+    }
+    for (k=0; k < 4; k++) {
+      _mm_storeu_ps(t, lx);
+      if (i > 0 && t[k] < lo[0]) lo[0] = t[k];
+      _mm_storeu_ps(t, ly);
+      if (i > 0 && t[k] < lo[1]) lo[1] = t[k];
+      _mm_storeu_ps(t, lz);
+      if (i > 0 && t[k] < lo[2]) lo[2] = t[k];
+      _mm_storeu_ps(t, hx);
+      if (i > 0 && t[k] > hi[0]) hi[0] = t[k];
+      _mm_storeu_ps(t, hy);
+      if (i > 0 && t[k] > hi[1]) hi[1] = t[k];
+      _mm_storeu_ps(t, hz);
+      if (i > 0 && t[k] > hi[2]) hi[2] = t[k];
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    for (j=0; j < 3; j++) {
+      sum[j] += xyz[3*i+j];
+      if (xyz[3*i+j] < lo[j]) lo[j] = xyz[3*i+j];
+      if (xyz[3*i+j] > hi[j]) hi[j] = xyz[3*i+j];
+    }
+  }
+  for (j=0; j < 3; j++)
+    centroid[j] = n > 0 ? sum[j]/n : 0.0;
+}
+
+/*
+  Eigenvalues of the symmetric 3x3 matrix 'a', in decreasing order,
+  by the trigonometric method of O.K. Smith, CACM 4 (1961) 168.
+*/
+static void eigenvalues3 (double a[3][3], double *ev)
+{
+  double p1, p2, p, q, r, phi, t, b[3][3];
+  int i, j;
+
+  p1 = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+  q = (a[0][0] + a[1][1] + a[2][2])/3.0;
+  if (p1 == 0.0) {
+    for (i=0; i < 3; i++)
+      ev[i] = a[i][i];
+  } else {
+    p2 = (a[0][0]-q)*(a[0][0]-q) + (a[1][1]-q)*(a[1][1]-q) + (a[2][2]-q)*(a[2][2]-q) + 2.0*p1;
+    p = sqrt(p2/6.0);
+    for (i=0; i < 3; i++)
+      for (j=0; j < 3; j++)
+	b[i][j] = (a[i][j] - (i == j ? q : 0.0))/p;
+    r = (b[0][0]*(b[1][1]*b[2][2] - b[1][2]*b[2][1])
+	 - b[0][1]*(b[1][0]*b[2][2] - b[1][2]*b[2][0])
+	 + b[0][2]*(b[1][0]*b[2][1] - b[1][1]*b[2][0]))/2.0;
+    phi = r <= -1.0 ? M_PI/3.0 : r >= 1.0 ? 0.0 : acos(r)/3.0;
+    ev[0] = q + 2.0*p*cos(phi);
+    ev[2] = q + 2.0*p*cos(phi + 2.0*M_PI/3.0);
+    ev[1] = 3.0*q - ev[0] - ev[2];
+  }
+  for (i=0; i < 2; i++)		// sort in decreasing order
+    for (j=i+1; j < 3; j++)
+      if (ev[j] > ev[i]) {
+	t = ev[i];
+	ev[i] = ev[j];
+	ev[j] = t;
+      }
+}
+
+/*
+  Root mean square deviation between two sets of 'n' points. If 'fit'
+  is set, the deviation after optimal superposition is returned; it is
+  computed from the singular values of the correlation matrix
+  (W. Kabsch, Acta Cryst. A32 (1976) 922), without forming the
+  rotation. Sums are accumulated in double precision.
+*/
+double xyz_rmsd (const float *a, const float *b, int64_t n, int fit)
+{
+  double ca[3], cb[3], r[3][3], rtr[3][3], ev[3], e0 = 0.0, d, det, s, s0, s1;
+  float lo[3], hi[3];
+  register int64_t i;
+  int j, k;
+
+  if (n <= 0)
+    return 0.0;
+
+  if (!fit) {
+    for (i=0; i < 3*n; i++) {
+      d = (double)a[i] - b[i];
+      e0 += d*d;
+    }
+    return sqrt(e0/n);
+  }
+
+  xyz_extent (a, n, ca, lo, hi);
+  xyz_extent (b, n, cb, lo, hi);
+  for (j=0; j < 3; j++)
+    for (k=0; k < 3; k++)
+      r[j][k] = 0.0;
+
+  for (i=0; i < n; i++) {
+    double x[3], y[3];
+    for (j=0; j < 3; j++) {
+      x[j] = a[3*i+j] - ca[j];
+      y[j] = b[3*i+j] - cb[j];
+      e0 += x[j]*x[j] + y[j]*y[j];
+    }
+    for (j=0; j < 3; j++)
+      for (k=0; k < 3; k++)
+	r[j][k] += y[j]*x[k];
+  }
+
+  for (j=0; j < 3; j++)
+    for (k=0; k < 3; k++)
+      rtr[j][k] = r[0][j]*r[0][k] + r[1][j]*r[1][k] + r[2][j]*r[2][k];
+  eigenvalues3 (rtr, ev);
+
+  det = r[0][0]*(r[1][1]*r[2][2] - r[1][2]*r[2][1])
+    - r[0][1]*(r[1][0]*r[2][2] - r[1][2]*r[2][0])
+    + r[0][2]*(r[1][0]*r[2][1] - r[1][1]*r[2][0]);
+  // det = +-s0*s1*s2 gives the smallest singular value, with its sign,
+  // far more accurately than the square root of the smallest
+  // eigenvalue, which is close to 0 for points in a plane
+  s0 = sqrt(ev[0] > 0.0 ? ev[0] : 0.0);
+  s1 = sqrt(ev[1] > 0.0 ? ev[1] : 0.0);
+  s = s0 + s1;
+  if (s0*s1 > 0.0)
+    s += det/(s0*s1);
+
+  d = (e0 - 2.0*s)/n;
+  return d > 0.0 ? sqrt(d) : 0.0;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
@@ -8,17 +8,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
+#include <string.h>
+#include <errno.h>
 #include <inttypes.h> // define int32_t
 #include "odb_io.h"
 
+/* Largest number of bytes transferred by a single read() or pread() */
+#define CHUNK (1<<30)
+
+/* Bytes hashed at a time by hash_record, a multiple of 8 */
+#define HASH_CHUNK (1<<20)
+
 /*
   Swap bytes in n 4-byte words
 */
-static void
-swap4 (char *buffer, int n)
+void
+swap4 (char *buffer, int64_t n)
 {
-  register int i;
+  register int64_t i;
   char j;
 
   for (i=0; i < n*4; i+=4) {
@@ -32,55 +41,200 @@ swap4 (char *buffer, int n)
 }
 
 /*
-  Read the parameter (datablock) from a binary O file.
+  Read 'n' bytes, in chunks, and continuing after short reads. Returns
+  the number of bytes read, which is less than 'n' only at end of
+  file, or -1 on error.
+*/
+int64_t read_full (int fd, void *buf, int64_t n)
+{
+  int64_t done = 0;
+  ssize_t k;
+
+  while (done < n) {
+    k = read (fd, (char *)buf + done, n - done > CHUNK ? CHUNK : n - done);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k < 0)
+      return -1;
+    if (k == 0)
+      break;
+    done += k;
+  }
+  return done;
+}
+
+/*
+  As read_full, but read at 'offset' without moving the file pointer.
+*/
+int64_t pread_full (int fd, void *buf, int64_t n, off_t offset)
+{
+  int64_t done = 0;
+  ssize_t k;
+
+  while (done < n) {
+    k = pread (fd, (char *)buf + done, n - done > CHUNK ? CHUNK : n - done,
+	       offset + done);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k < 0)
+      return -1;
+    if (k == 0)
+      break;
+    done += k;
+  }
+  return done;
+}
+
+/*
+  Read one fortran record, storing at most 'maxlen' bytes in 'buf';
+  the rest is skipped. Records longer than 2 GB are written by
+  gfortran as a sequence of subrecords. A negative leading length
+  means that more subrecords follow, and a negative trailing length
+  that the subrecord continues a previous one. Returns the total
+  length of the record, -1 at end of file, or -2 if the record
+  framing is broken.
+*/
+static int64_t read_subrecords (int fd, char *buf, int64_t maxlen, int swap)
+{
+  int32_t rl1, rl2;
+  int64_t len, want, total = 0;
+  int more;
+
+  do {
+    len = read_full (fd, &rl1, 4);
+    if (len == 0 && total == 0)
+      return -1;
+    if (len != 4)
+      return -2;
+    if (swap) swap4 ((char *)&rl1, 1);
+    more = rl1 < 0;
+    len = rl1 < 0 ? -(int64_t)rl1 : rl1;
+
+    want = 0;
+    if (buf && total < maxlen)
+      want = len < maxlen - total ? len : maxlen - total;
+    if (want > 0 && read_full (fd, buf + total, want) != want)
+      return -2;
+    if (len > want && lseek (fd, len - want, SEEK_CUR) < 0)
+      return -2;
+
+    if (read_full (fd, &rl2, 4) != 4)
+      return -2;
+    if (swap) swap4 ((char *)&rl2, 1);
+    if ((rl2 < 0 ? -(int64_t)rl2 : rl2) != len)
+      return -2;
+    total += len;
+  } while (more);
+
+  return total;
+}
+
+/*
+  Decode a datablock header record of 30 bytes.
 */
-int read_param (int fd, char *par, char *partyp, int *size, int swap)
+static void decode_param (char *buf, char *par, char *partyp, int64_t *size, int swap)
 {
   int n;
-  int32_t  rl1, rl2;
+  int32_t siz;
 
-  n = read (fd, &rl1, 4);
-  if (n == 0) return -1;
-  if (swap) swap4 ((char *)&rl1, 1);
-  n = read (fd, par, 25);
   // convert datablock name to lower case
   for (n=0; n<25; n++)
-    par[n] = tolower(par[n]);
-  n = read (fd, partyp, 1);
-  n = read (fd, size, 4);
-  if (swap) swap4 ((char *)size, 1);
-  n = read (fd, &rl2, 4);
-  if (swap) swap4 ((char *)&rl2, 1);
-
-  if (rl1 != rl2) {
-    fprintf (stderr, "Error reading parameter header (%d %d %d)\n",
-	     *size, rl1, rl2);
+    par[n] = tolower(buf[n]);
+  *partyp = buf[25];
+  memcpy (&siz, buf+26, 4);
+  if (swap) swap4 ((char *)&siz, 1);
+  *size = siz;
+}
+
+/*
+  Read the parameter (datablock) from a binary O file.
+*/
+int read_param (int fd, char *par, char *partyp, int64_t *size, int swap)
+{
+  int64_t len;
+  char buf[30];
+
+  len = read_subrecords (fd, buf, 30, swap);
+  if (len == -1) return -1;
+  if (len != 30) {
+    fprintf (stderr, "Error reading parameter header (%" PRId64 ")\n", len);
     return -2;
   }
+  decode_param (buf, par, partyp, size, swap);
   return 0;
 }
 
 /*
-  Read a text datablock from the binary file
+  Find the length of the fortran record at file offset 'offset' from
+  its length markers, following its subrecords, without reading the
+  data. The offset of the next record is returned in 'next'. Returns
+  -1 if 'offset' is the end of the file, or -2 if the framing is
+  broken or the record is cut short.
 */
-int read_text (int fd, char *text, int size, int swap)
+int64_t frame_record (int fd, off_t offset, off_t *next, int swap)
 {
-  int n;
   int32_t rl1, rl2;
+  int64_t len, total = 0, k;
+  int more;
+
+  do {
+    k = pread_full (fd, &rl1, 4, offset);
+    if (k == 0 && total == 0)
+      return -1;
+    if (k != 4)
+      return -2;
+    if (swap) swap4 ((char *)&rl1, 1);
+    more = rl1 < 0;
+    len = rl1 < 0 ? -(int64_t)rl1 : rl1;
+    if (pread_full (fd, &rl2, 4, offset + 4 + len) != 4)
+      return -2;
+    if (swap) swap4 ((char *)&rl2, 1);
+    if ((rl2 < 0 ? -(int64_t)rl2 : rl2) != len)
+      return -2;
+    total += len;
+    offset += len + 8;
+  } while (more);
+
+  *next = offset;
+  return total;
+}
+
+/*
+  As read_param, but read the header at file offset 'offset', without
+  printing anything. The offset of the record after the header is
+  returned in 'next'. Returns 0, -1 at the end of the file, or -2 if
+  the header is broken.
+*/
+int pread_param (int fd, off_t offset, char *par, char *partyp, int64_t *size,
+		 off_t *next, int swap)
+{
+  int64_t len;
+  char buf[30];
+
+  len = frame_record (fd, offset, next, swap);
+  if (len == -1) return -1;
+  if (len != 30 || pread_record (fd, offset, buf, 0, 30, swap) != 30)
+    return -2;
+  decode_param (buf, par, partyp, size, swap);
+  return 0;
+}
 
-  n = read (fd, &rl1, 4);
-  if (n == 0) return -1;
-  if (swap) swap4 ((char *)&rl1, 1);
-  n = read (fd, text, rl1);
-  n = read (fd, &rl2, 4);
-  if (swap) swap4 ((char *)&rl2, 1);
+/*
+  Read a text datablock from the binary file
+*/
+int read_text (int fd, char *text, int64_t size, int swap)
+{
+  int64_t len;
 
-  if (rl1 != rl2) {
+  len = read_subrecords (fd, text, size, swap);
+  if (len == -1) return -1;
+  if (len < 0) {
     fprintf (stderr, "Error read text block\n");
     return -2;
   }
-  if (size != rl2)
-    fprintf (stderr, "read_text: Expected %d, got %d elements\n", size, rl2);
+  if (size != len)
+    fprintf (stderr, "read_text: Expected %" PRId64 ", got %" PRId64 " elements\n",
+	     size, len);
 
   return 0;
 }
@@ -88,79 +242,296 @@ int read_text (int fd, char *text, int size, int swap)
 /*
    Read 'size' C6 variables from the binary fortran file.
 */
-int read_c6 (int fd, char *cstore, int size, int swap)
+int read_c6 (int fd, char *cstore, int64_t size, int swap)
 {
-  int n;
-  int32_t rl1, rl2;
-
-  n = read (fd, &rl1, 4);
-  if (n == 0) return -1;
-  if (swap) swap4 ((char *)&rl1, 1);
-  n = read (fd, cstore, rl1);
-  n = read (fd, &rl2, 4);
-  if (swap) swap4 ((char *)&rl2, 1);
+  int64_t len;
 
-  if (rl1 != rl2) {
+  len = read_subrecords (fd, cstore, 6*size, swap);
+  if (len == -1) return -1;
+  if (len < 0) {
     fprintf (stderr, "Error read character block\n");
     return -2;
   }
-  if (6*size != rl2)
-    fprintf (stderr, "read_c6: Expected %d, got %d elements\n", 6*size, rl2);
+  if (6*size != len)
+    fprintf (stderr, "read_c6: Expected %" PRId64 ", got %" PRId64 " elements\n",
+	     6*size, len);
 
   return 0;
 }
 
 /*
-  Read 'size' integers from the binary fortran file.  Swap bytes if
-  necessary, file is always in big-endian order.
+  Read 'size' 4-byte words. Swap bytes if necessary, file is always in
+  big-endian order.
 */
-int read_int4 (int fd, int *istore, int size, int swap)
+static int read_word4 (int fd, char *store, int64_t size, int swap, char *what)
 {
-  int n;
-  int32_t rl1, rl2;
+  int64_t len;
 
-  n = read (fd, &rl1, 4);
-  if (n == 0) return -1;
-  if (swap) swap4 ((char *)&rl1, 1);
-  n = read (fd, istore, rl1);
-  if (swap) swap4 ((char *)istore, size);
-  n = read (fd, &rl2, 4);
-  if (swap) swap4 ((char *)&rl2, 1);
-
-  if (rl1 != rl2) {
-    fprintf (stderr, "Error read int block\n");
+  len = read_subrecords (fd, store, 4*size, swap);
+  if (len == -1) return -1;
+  if (len < 0) {
+    fprintf (stderr, "Error read %s block\n", what);
     return -2;
   }
-  if (4*size != rl2)
-    fprintf (stderr, "read_int4: Expected %d, got %d elements\n", 4*size, rl2);
+  if (swap) swap4 (store, (len < 4*size ? len : 4*size)/4);
+  if (4*size != len)
+    fprintf (stderr, "read_%s4: Expected %" PRId64 ", got %" PRId64 " elements\n",
+	     what, 4*size, len);
 
   return 0;
 }
 
 /*
-   Read 'size' floats from the binary fortran file.  Swap bytes if
-   necessary, file is always in big-endian order.
+  Read 'size' integers from the binary fortran file.
 */
-int read_float4 (int fd, float *rstore, int size, int swap)
+int read_int4 (int fd, int *istore, int64_t size, int swap)
 {
-  int n;
-  int32_t rl1, rl2;
+  return read_word4 (fd, (char *)istore, size, swap, "int");
+}
 
-  n = read (fd, &rl1, 4);
-  if (n == 0) return -1;
-  if (swap) swap4 ((char *)&rl1, 1);
-  n = read (fd, rstore, rl1);
-  if (swap) swap4 ((char *)rstore, size);
-  n = read (fd, &rl2, 4);
-  if (swap) swap4 ((char *)&rl2, 1);
+/*
+   Read 'size' floats from the binary fortran file.
+*/
+int read_float4 (int fd, float *rstore, int64_t size, int swap)
+{
+  return read_word4 (fd, (char *)rstore, size, swap, "float");
+}
 
-  if (rl1 != rl2) {
+/*
+  Read 'size' floats holding x,y,z coordinates, and apply the 4x4
+  matrix 'mat' while the data are byte swapped, in a single pass.
+*/
+int read_xyz (int fd, float *rstore, int64_t size, int swap, const float *mat)
+{
+  int64_t len;
+
+  len = read_subrecords (fd, (char *)rstore, 4*size, swap);
+  if (len == -1) return -1;
+  if (len < 0) {
     fprintf (stderr, "Error read float block\n");
     return -2;
   }
-  if (4*size != rl2)
-    fprintf (stderr, "read_float4: Expected %d, got %d elements\n", 4*size, rl2);
+  xyz_transform (rstore, size/3, mat, swap);
+  if (4*size != len)
+    fprintf (stderr, "read_xyz: Expected %" PRId64 ", got %" PRId64 " elements\n",
+	     4*size, len);
+
+  return 0;
+}
+
+/*
+  Read one complete fortran record into a newly allocated buffer. The
+  length of the record in bytes is returned in 'nbytes'. The buffer is
+  not byte swapped. Returns NULL at end of file or if the record
+  framing is broken.
+*/
+char *read_record (int fd, int64_t *nbytes, int swap)
+{
+  int64_t len;
+  off_t offset;
+  char *buf;
+
+  // find the length first, the record may consist of several subrecords
+  offset = lseek (fd, 0, SEEK_CUR);
+  len = read_subrecords (fd, NULL, 0, swap);
+  if (len < 0) {
+    if (len == -2)
+      fprintf (stderr, "Error reading record\n");
+    return NULL;
+  }
+  buf = malloc (len > 0 ? len : 1);
+  if (!buf) return NULL;
+  lseek (fd, offset, SEEK_SET);
+  if (read_subrecords (fd, buf, len, swap) != len) {
+    free (buf);
+    return NULL;
+  }
+  *nbytes = len;
+  return buf;
+}
+
+/*
+  Skip one fortran record without reading it. Returns the length of
+  the record, or -1 at end of file or on a framing error.
+*/
+int64_t skip_record (int fd, int swap)
+{
+  int64_t len;
+
+  len = read_subrecords (fd, NULL, 0, swap);
+  return len < 0 ? -1 : len;
+}
+
+/*
+  Read 'n' bytes starting at byte 'start' of the payload of the
+  fortran record at file offset 'offset', without reading the rest of
+  the record. Subrecords are followed through their length markers.
+  The data are not byte swapped. Returns the number of bytes read,
+  or -1 on error.
+*/
+int64_t pread_record (int fd, off_t offset, char *buf, int64_t start, int64_t n,
+		      int swap)
+{
+  int32_t rl;
+  int64_t len, k, done = 0;
+  int more;
+
+  do {
+    if (pread_full (fd, &rl, 4, offset) != 4)
+      return -1;
+    if (swap) swap4 ((char *)&rl, 1);
+    more = rl < 0;
+    len = rl < 0 ? -(int64_t)rl : rl;
+    if (start < len) {
+      k = len - start < n - done ? len - start : n - done;
+      if (pread_full (fd, buf + done, k, offset + 4 + start) != k)
+	return -1;
+      done += k;
+      start = 0;
+    } else {
+      start -= len;
+    }
+    offset += len + 8;
+  } while (more && done < n);
+
+  return done;
+}
+
+/*
+  Find datablock 'name' in a binary O file by reading the headers and
+  skipping the data records. Returns the file offset of the data
+  record, or -1 if the datablock is not found.
+*/
+off_t find_param (int fd, char *name, char *partyp, int64_t *size, int swap)
+{
+  char par[26], *s;
+  off_t offset;
 
+  memset (par, 0, 26);
+  while (read_param (fd, par, partyp, size, swap) == 0 && *size != 0) {
+    /* strip spaces off end of datablock name */
+    s = &par[25];
+    while (*s <= 32 && s > par)
+      *s-- = '\0';
+    offset = lseek (fd, 0, SEEK_CUR);
+    if (strcmp (par, name) == 0)
+      return offset;
+    if (skip_record (fd, swap) < 0)
+      break;
+  }
+  return -1;
+}
+
+/*
+  Add a datablock to the list of entries, which is grown as needed.
+  If memory runs out, the list is freed and 'n' set to -1.
+*/
+odb_entry *add_entry (odb_entry **list, int *n, int *nalloc)
+{
+  odb_entry *e;
+
+  if (*n == *nalloc) {
+    *nalloc = *nalloc ? 2 * *nalloc : 64;
+    e = realloc (*list, *nalloc * sizeof(odb_entry));
+    if (!e) {
+      free (*list);
+      *list = NULL;
+      *n = -1;
+      return NULL;
+    }
+    *list = e;
+  }
+  e = &(*list)[(*n)++];
+  memset (e, 0, sizeof(odb_entry));
+  return e;
+}
+
+/*
+  Find the datablocks of a binary O file, skipping their data records.
+  The number of datablocks is returned in 'n', or -1 on error.
+*/
+odb_entry *scan_binary_file (char *fnam, int *n)
+{
+  int fd, nalloc = 0;
+  char par[26], typ, *s;
+  int64_t siz;
+  odb_entry *list = NULL, *e;
+
+  *n = 0;
+  fd = open (fnam, O_RDONLY);
+  if (fd < 0) {
+    *n = -1;
+    return NULL;
+  }
+  memset (par, 0, 26);
+  while (read_param (fd, par, &typ, &siz, DOSWAP) == 0 && siz != 0) {
+    s = &par[25];
+    while (*s <= 32 && s > par)
+      *s-- = '\0';
+    if (typ == 'I' || typ == 'R' || typ == 'C' || typ == 'T') {
+      e = add_entry (&list, n, &nalloc);
+      if (!e)
+	break;
+      memcpy (e->name, par, 26);
+      e->typ = typ;
+      e->size = siz;
+      e->nbytes = typ == 'C' ? 6*siz : typ == 'T' ? siz : 4*siz;
+      e->src = lseek (fd, 0, SEEK_CUR);
+    }
+    if (skip_record (fd, DOSWAP) < 0)
+      break;
+  }
+  close (fd);
+  return list;
+}
+
+/*
+  Continue the 64-bit hash 'h' of a byte string with 'n' more bytes,
+  8 bytes at a time. Start with h = 0. A string hashed in pieces gives
+  the same hash as hashed at once, as long as all pieces but the last
+  are a multiple of 8 bytes long. Used to detect datablocks whose
+  contents have changed since they were last read.
+*/
+uint64_t hash_bytes (uint64_t h, const char *buf, int64_t n)
+{
+  uint64_t w;
+
+  for (; n >= 8; n -= 8, buf += 8) {
+    memcpy (&w, buf, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  if (n > 0) {
+    w = n;			// the length of the tail tells "ab" from "ab\0"
+    memcpy ((char *)&w + 1, buf, n);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+/*
+  Hash the 'nbytes' bytes of the payload of the fortran record at
+  file offset 'offset', reading it in pieces. Returns 0 on success.
+*/
+int hash_record (int fd, off_t offset, int64_t nbytes, int swap, uint64_t *h)
+{
+  int64_t done, k;
+  char *buf;
+
+  buf = malloc (HASH_CHUNK);
+  if (!buf)
+    return -1;
+  *h = 0;
+  for (done=0; done < nbytes; done += k) {
+    k = nbytes - done < HASH_CHUNK ? nbytes - done : HASH_CHUNK;
+    if (pread_record (fd, offset, buf, done, k, swap) != k) {
+      free (buf);
+      return -1;
+    }
+    *h = hash_bytes (*h, buf, k);
+  }
+  free (buf);
   return 0;
 }
 
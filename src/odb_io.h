@@ -3,25 +3,161 @@
    License: GPL
 */
 
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #if defined(MIPSEL) || defined(__i386__) || defined(__x86_64__) || defined(WIN32)
 #  define DOSWAP 1
 #else
 #  define DOSWAP 0
 #endif
 
+/* A datablock found by scanning a file, and where its data start */
+typedef struct {
+  char name[26];
+  char typ;
+  int reclen;			/* record length of formatted type T, else 0 */
+  int64_t size;			/* number of elements */
+  int64_t nbytes;		/* size of the decoded data in bytes */
+  off_t src;			/* file offset of the data */
+  char fmt[64];			/* format of a formatted datablock */
+} odb_entry;
+
+odb_entry *add_entry (odb_entry **list, int *n, int *nalloc);
+
 /* Declaration of binary read functions */
-int read_param (int fd, char *par, char *partyp, int *size, int swap);
-int read_text (int fd, char *text, int size, int swap);
-int read_c6 (int fd, char *cstore, int size, int swap);
-int read_int4 (int fd, int *istore, int size, int swap);
-int read_float4 (int fd, float *rstore, int size, int swap);
+int read_param (int fd, char *par, char *partyp, int64_t *size, int swap);
+int read_text (int fd, char *text, int64_t size, int swap);
+int read_c6 (int fd, char *cstore, int64_t size, int swap);
+int read_int4 (int fd, int *istore, int64_t size, int swap);
+int read_float4 (int fd, float *rstore, int64_t size, int swap);
+int read_xyz (int fd, float *rstore, int64_t size, int swap, const float *mat);
+char *read_record (int fd, int64_t *nbytes, int swap);
+int64_t skip_record (int fd, int swap);
+int64_t pread_record (int fd, off_t offset, char *buf, int64_t start, int64_t n,
+		      int swap);
+int64_t frame_record (int fd, off_t offset, off_t *next, int swap);
+int pread_param (int fd, off_t offset, char *par, char *partyp, int64_t *size,
+		 off_t *next, int swap);
+off_t find_param (int fd, char *name, char *partyp, int64_t *size, int swap);
+odb_entry *scan_binary_file (char *fnam, int *n);
+int64_t read_full (int fd, void *buf, int64_t n);
+int64_t pread_full (int fd, void *buf, int64_t n, off_t offset);
+
+/* Declaration of formatted write functions */
+#define INT4_FORMAT "(6(1x,i11))"
+#define INT4_PER_LINE 6
+#define FLOAT4_FORMAT "(5(1x,e15.8))"
+#define FLOAT4_PER_LINE 5
+#define C6_FORMAT "(10(1x,a6))"
+#define C6_PER_LINE 10
+
+int write_param_f (FILE *fp, char *par, char partyp, int64_t size, char *fmt);
+int write_int4_f (FILE *fp, int *array, int64_t size);
+int write_float4_f (FILE *fp, float *array, int64_t size);
+int write_c6_f (FILE *fp, char *array, int64_t size);
+int write_text_f (FILE *fp, char *array, int64_t nrec, int size);
+int format_float (float f, char *buf);
+
+/* An O molecule, as needed for coordinate output */
+typedef struct {
+  int natoms, nres;		/* limited by the 32 bit residue pointers */
+  float *xyz, *b, *wt;		/* coordinates, B-factors and occupancies */
+  char *atom_name;		/* 6 characters per atom */
+  char *res_name, *res_type;	/* 6 characters per residue */
+  int *res_ptr;			/* first and last atom of each residue */
+} odb_molecule;
+
+/* Declaration of coordinate output functions */
+int read_molecule (char *fnam, int binary, char *mol, odb_molecule *m);
+int check_molecule (odb_molecule *m);
+void free_molecule (odb_molecule *m);
+long write_pdb (int fd, odb_molecule *m);
+long write_mmcif (int fd, char *mol, odb_molecule *m);
+
+/*
+  A decoded O file, as kept in shared memory. The header is followed
+  by a table of 'nblocks' datablocks, and then by their data. Integers
+  and reals are in native byte order.
+*/
+typedef struct {
+  char magic[8];
+  int32_t ready;		/* set when the segment is complete */
+  int32_t nblocks;
+  int32_t binary;		/* made from a binary file */
+  int32_t pad;
+  int64_t dev, ino;		/* of the file it was made from */
+  int64_t mtime, mtime_nsec;
+  int64_t filesize;
+  int64_t length;		/* length of the segment in bytes */
+} odb_shm_header;
+
+typedef struct {
+  char name[26];
+  char typ;
+  char pad;
+  int32_t reclen;		/* record length of formatted type T, else 0 */
+  int64_t size;			/* number of elements */
+  int64_t offset;		/* of the data, from the start of the segment */
+  int64_t nbytes;
+} odb_shm_block;
+
+/* Declaration of decoded image and shared memory cache functions */
+odb_entry *image_scan (char *fnam, int binary, int *n, int64_t *length);
+int image_fill (odb_shm_header *hdr, int64_t length, char *fnam, int binary,
+		odb_entry *list, int n, volatile int *cancel);
+odb_shm_header *shm_attach (char *fnam, int binary);
+void shm_detach (odb_shm_header *hdr);
+int shm_remove (char *fnam);
+int same_file (struct stat *a, struct stat *b);
+
+/* An open O file, for comparing datablocks */
+typedef struct {
+  int binary;
+  int fd;			/* binary file */
+  FILE *fp;			/* formatted file */
+  odb_entry *blocks;
+  int nblocks;
+} odb_file;
+
+/* Declaration of comparison functions */
+int odb_open (char *fnam, int binary, odb_file *f);
+void odb_close (odb_file *f);
+int64_t diff_block (odb_file *a, odb_entry *ea, odb_file *b, odb_entry *eb,
+		    double rtol, double atol);
+
+/* Declaration of thread pool functions */
+int pool_submit (void (*work) (void *), void *arg);
+
+/* Declaration of verification functions */
+uint32_t crc32c (uint32_t crc, const char *buf, int64_t n);
+int verify_framing (char *fnam, odb_entry **list, int *n, struct stat *fst, char *msg);
+int verify_crc (char *fnam, odb_entry *list, int n, uint32_t *crc);
+
+/* Declaration of coordinate kernels */
+void xyz_transform (float *xyz, int64_t n, const float *mat, int swap);
+void xyz_extent (const float *xyz, int64_t n, double *centroid, float *lo, float *hi);
+double xyz_rmsd (const float *a, const float *b, int64_t n, int fit);
+
+/* Utilities */
+void swap4 (char *buffer, int64_t n);
+uint64_t hash_bytes (uint64_t h, const char *buf, int64_t n);
+int hash_record (int fd, off_t offset, int64_t nbytes, int swap, uint64_t *h);
 
 /* Declaration of formatted read functions */
-int read_param_f (FILE *fp, char *par, char *partyp, int *size, char *fmt);
-int read_int4_f (FILE *fp, int *array, int size);
-int read_float4_f (FILE *fp, float *array, int size);
-int read_c6_f (FILE *fp, char *array, int size, char *fmt);
-int read_text_f (FILE *fp, char *array, int nrec, int size);
+int read_param_f (FILE *fp, char *par, char *partyp, int64_t *size, char *fmt);
+int read_int4_f (FILE *fp, int *array, int64_t size);
+int read_float4_f (FILE *fp, float *array, int64_t size);
+int read_c6_f (FILE *fp, char *array, int64_t size, char *fmt);
+int64_t read_text_f (FILE *fp, char *array, int64_t nrec, int size);
+int skip_words_f (FILE *fp, int64_t n);
+int skip_lines_f (FILE *fp, int64_t n);
+int c6_per_line_f (char *fmt);
+int skip_c6_f (FILE *fp, int64_t size, char *fmt);
+int skip_block_f (FILE *fp, char partyp, int64_t size, char *fmt);
+int find_param_f (FILE *fp, char *name, char *partyp, int64_t *size, char *fmt);
+odb_entry *scan_formatted_file (char *fnam, int *n);
 
 /*
   Local Variables: 
@@ -9,6 +9,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <inttypes.h>
+#include "odb_io.h"
 
 #define MAXWORD 100
 
@@ -41,7 +43,7 @@ static char * getword(FILE *fp)
   Read the header of a formatted O file. Reads past any comments and
   blank lines
 */
-int read_param_f (FILE *fp, char *par, char *partyp, int *size, char *fmt)
+int read_param_f (FILE *fp, char *par, char *partyp, int64_t *size, char *fmt)
 {
   char buf[256], *ch, *stat;
 
@@ -76,7 +78,7 @@ int read_param_f (FILE *fp, char *par, char *partyp, int *size, char *fmt)
   ch = strtok(NULL, " ");
   if (!ch)
     return 2;
-  *size = (int)strtol(ch, &stat, 10);
+  *size = strtoll(ch, &stat, 10);
   if (*stat) {
     fprintf (stderr, "non-digits in datablock size\n");
     return 3;
@@ -95,9 +97,9 @@ int read_param_f (FILE *fp, char *par, char *partyp, int *size, char *fmt)
   Read 'size' integers from the file
 */
 
-int read_int4_f (FILE *fp, int *array, int size)
+int read_int4_f (FILE *fp, int *array, int64_t size)
 {
-  register int i;
+  register int64_t i;
   char *ch, *stat;
 
   for (i=0; i<size; i++) {
@@ -115,9 +117,9 @@ int read_int4_f (FILE *fp, int *array, int size)
 /*
   Read 'size' floats from the file
 */
-int read_float4_f (FILE *fp, float *array, int size)
+int read_float4_f (FILE *fp, float *array, int64_t size)
 {
-  register int i;
+  register int64_t i;
   char *ch, *stat;
 
   for (i=0; i<size; i++) {
@@ -218,15 +220,23 @@ static char *parse_format(char *fmt)
 }
 
 /*
-  Read 'size' C6 variables from the file
+  Read 'size' C6 variables from the file. A line that ends early, as
+  when trailing spaces have been stripped, is padded with spaces.
+  The rest of the last line is skipped, so the file is left at the
+  start of a line. Returns 1 if the file ends first, or the format
+  holds no character variable.
 */
-int read_c6_f (FILE *fp, char *array, int size, char *fmt)
+int read_c6_f (FILE *fp, char *array, int64_t size, char *fmt)
 {
-  register int i;
-  char c, *a, *t, *s;
-  int eol, inword;
+  register int64_t i;
+  char *a, *t, *s;
+  int c = 0, eol, inword;
 
   t = parse_format(fmt);
+  if (!t || !strchr(t, '6')) {
+    free(t);
+    return 1;
+  }
   s = t;
   a = array;
 
@@ -235,20 +245,23 @@ int read_c6_f (FILE *fp, char *array, int size, char *fmt)
   while (i < size) {
     //fprintf (stderr, "%d ", i);
 
-    if (!*s) { // if end of format string, rewind it.
-      s = t;   // and reset everything
+    if (!*s) { // if end of format string, rewind it,
+      s = t;   // and go to the next line unless we are there already
+      if (!eol)
+	while ((c = getc(fp)) != '\n' && c != EOF)
+	  ;
+      if (c == EOF)
+	break;
       eol = 0;
-      while (fgetc(fp) != '\n')
-	;
-      //fprintf (stderr, "rewind\n");
     }
 
     inword = 1;
     while (inword) {
-      if (!eol)
-	c = fgetc(fp);
-      if (c == '\n')
-	eol = 1;
+      if (!eol) {
+	c = getc(fp);
+	if (c == '\n' || c == EOF)
+	  eol = 1;
+      }
       switch (*s++) {
       case '_':
 	break;
@@ -257,46 +270,200 @@ int read_c6_f (FILE *fp, char *array, int size, char *fmt)
       case '3':
       case '4':
       case '5':
-	if (eol)
-	  //*a++ = ' ';
-	  *a++ = '#';
-	else
-	  *a++ = c;
+	*a++ = eol ? ' ' : c;
 	break;
       case '6':
-	if (eol)
-	  //*a++ = ' ';
-	  *a++ = '6';
-	else
-	  *a++ = c;
+	*a++ = eol ? ' ' : c;
 	i++;
 	inword = 0;
 	break;
       }
     }  // end get one word
   }
+  if (!eol)
+    while ((c = getc(fp)) != '\n' && c != EOF)
+      ;
   free(t);
-  return 0;
+  return i < size;
 }
 
 /*
-  Read a text datablock from the formatted file
+  Read a text datablock from the formatted file. Returns the number of
+  bytes read, which is short if the file ends first.
 */
-int read_text_f (FILE *fp, char *array, int nrec, int size)
+int64_t read_text_f (FILE *fp, char *array, int64_t nrec, int size)
 {
   char buf[256];
-  register int i;
-  int j, n;
+  register int64_t i;
+  int64_t j;
 
   for (i=0, j=0; i<nrec; i++) {
-    fgets (buf, 256, fp);
-    n = strlen(buf);
+    if (!fgets (buf, 256, fp))
+      break;
     strncpy (array+j, buf, size);
     j += size;
   }
   return j;
 }
 
+/*
+  Skip 'n' words without converting them. Like getword(), the
+  separator following the last word is consumed.
+*/
+int skip_words_f (FILE *fp, int64_t n)
+{
+  register int64_t i;
+  int c;
+
+  for (i=0; i<n; i++) {
+    while ((c = getc(fp)) != EOF && isspace(c))
+      ;
+    if (c == EOF)
+      return 1;
+    while ((c = getc(fp)) != EOF && !isspace(c))
+      ;
+  }
+  return 0;
+}
+
+/*
+  Skip 'n' lines.
+*/
+int skip_lines_f (FILE *fp, int64_t n)
+{
+  register int64_t i;
+  int c;
+
+  for (i=0; i<n; i++) {
+    while ((c = getc(fp)) != EOF && c != '\n')
+      ;
+    if (c == EOF)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+  Return the number of C6 variables on each line of a type C
+  datablock written with the format 'fmt'.
+*/
+int c6_per_line_f (char *fmt)
+{
+  char *t, *s;
+  int n = 0;
+
+  t = parse_format(fmt);
+  if (!t)
+    return 0;
+  for (s=t; *s; s++)
+    if (*s == '6')
+      n++;
+  free(t);
+  return n;
+}
+
+/*
+  Skip 'size' C6 variables. The format tells how many there are on
+  each line, so whole lines can be skipped.
+*/
+int skip_c6_f (FILE *fp, int64_t size, char *fmt)
+{
+  int perline;
+
+  perline = c6_per_line_f (fmt);
+  if (perline == 0)
+    return 1;
+  return skip_lines_f (fp, (size + perline - 1)/perline);
+}
+
+/*
+  Skip the data of a datablock of type 'partyp'.
+*/
+int skip_block_f (FILE *fp, char partyp, int64_t size, char *fmt)
+{
+  switch (toupper(partyp)) {
+  case 'I':
+  case 'R':
+    return skip_words_f (fp, size);
+  case 'C':
+    return skip_c6_f (fp, size, fmt);
+  case 'T':
+    return skip_lines_f (fp, size);
+  }
+  return 0;
+}
+
+/*
+  Find datablock 'name' in a formatted O file, skipping the data of
+  the datablocks before it. Returns 0 if the datablock is found, and
+  the file is then positioned at the start of its data.
+*/
+int find_param_f (FILE *fp, char *name, char *partyp, int64_t *size, char *fmt)
+{
+  char par[27];
+
+  par[26] = '\0';
+  while (read_param_f (fp, par, partyp, size, fmt) == 0) {
+    if (strcmp (par, name) == 0)
+      return 0;
+    if (skip_block_f (fp, *partyp, *size, fmt))
+      break;
+  }
+  return -1;
+}
+
+/*
+  Find the datablocks of a formatted O file, skipping their data.
+  The number of datablocks is returned in 'n', or -1 on error.
+*/
+odb_entry *scan_formatted_file (char *fnam, int *n)
+{
+  FILE *fp;
+  int nalloc = 0;
+  char par[27], typ, fmt[64];
+  int64_t siz;
+  odb_entry *list = NULL, *e;
+
+  *n = 0;
+  fp = fopen (fnam, "r");
+  if (!fp) {
+    *n = -1;
+    return NULL;
+  }
+  par[26] = '\0';
+  while (read_param_f (fp, par, &typ, &siz, fmt) == 0) {
+    typ = toupper(typ);
+    e = add_entry (&list, n, &nalloc);
+    if (!e)
+      break;
+    memcpy (e->name, par, 26);
+    e->name[25] = '\0';
+    e->typ = typ;
+    e->size = siz;
+    memcpy (e->fmt, fmt, 64);
+    e->src = ftello (fp);
+    switch (typ) {
+    case 'I':
+    case 'R':
+      e->nbytes = 4*siz;
+      break;
+    case 'C':
+      e->nbytes = 6*siz;
+      break;
+    case 'T':
+      e->reclen = strtol(fmt, NULL, 10);
+      e->nbytes = siz * e->reclen;
+      break;
+    default:
+      (*n)--;
+    }
+    if (skip_block_f (fp, typ, siz, fmt))
+      break;
+  }
+  fclose (fp);
+  return list;
+}
+
 /*
   Local Variables:
   mode: c
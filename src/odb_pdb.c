@@ -0,0 +1,580 @@
+/*
+   Routines to write the coordinates of an O molecule in PDB and
+   mmCIF format.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include "odb_io.h"
+
+#define OUTBUFSIZ (1<<20)
+#define FIXEDSIZ 48		// longest number put_fixed writes
+#define PDBLINE 82		// an ATOM record and the newline
+#define CIFLINE (5*FIXEDSIZ + 160)
+
+/*
+  The molecule datablocks we need, and where to put them.
+*/
+struct molblock {
+  char *suffix;
+  char typ;
+  void **data;
+  int64_t *size;
+};
+
+static void molblocks (odb_molecule *m, int64_t *size, struct molblock *b)
+{
+  struct molblock t[] = {
+    {"atom_xyz", 'R', (void **)&m->xyz, &size[0]},
+    {"atom_name", 'C', (void **)&m->atom_name, &size[1]},
+    {"atom_b", 'R', (void **)&m->b, &size[2]},
+    {"atom_wt", 'R', (void **)&m->wt, &size[3]},
+    {"residue_name", 'C', (void **)&m->res_name, &size[4]},
+    {"residue_type", 'C', (void **)&m->res_type, &size[5]},
+    {"residue_pointers", 'I', (void **)&m->res_ptr, &size[6]},
+    {NULL, 0, NULL, NULL}
+  };
+  memcpy (b, t, sizeof(t));
+}
+
+/*
+  Return the entry for datablock 'par' if it belongs to molecule 'mol'.
+*/
+static struct molblock *find_molblock (struct molblock *b, char *mol, char *par)
+{
+  int n = strlen(mol);
+
+  if (strncmp(par, mol, n) != 0 || par[n] != '_')
+    return NULL;
+  for (; b->suffix; b++)
+    if (strcmp(par+n+1, b->suffix) == 0)
+      return b;
+  return NULL;
+}
+
+/*
+  Read the datablocks of molecule 'mol' from a binary or formatted O
+  file. Other datablocks are skipped. Returns 0 on success, -1 if the
+  file cannot be opened, and -2 if the molecule is missing or its
+  datablocks are inconsistent.
+*/
+int read_molecule (char *fnam, int binary, char *mol, odb_molecule *m)
+{
+  struct molblock blocks[8], *b;
+  int64_t size[7] = {0, 0, 0, 0, 0, 0, 0};
+  char par[26], lmol[26], typ, fmt[64], *s, *buf;
+  int64_t siz, nbytes;
+  int fd, i;
+  FILE *fp;
+
+  memset (m, 0, sizeof(odb_molecule));
+  molblocks (m, size, blocks);
+  for (i=0; i<25 && mol[i]; i++)
+    lmol[i] = tolower(mol[i]);
+  lmol[i] = '\0';
+
+  if (binary) {
+    fd = open(fnam, O_RDONLY);
+    if (fd < 0)
+      return -1;
+    memset (par, 0, 26);
+    while (read_param(fd, par, &typ, &siz, DOSWAP) == 0 && siz > 0) {
+      s = &par[25];
+      while (*s <= 32 && s > par)
+	*s-- = '\0';
+      b = find_molblock(blocks, lmol, par);
+      if (!b || b->typ != typ || *b->data) {
+	if (skip_record(fd, DOSWAP) < 0)
+	  break;
+	continue;
+      }
+      buf = read_record(fd, &nbytes, DOSWAP);
+      if (!buf)
+	break;
+      if (typ == 'C')
+	siz = nbytes/6 < siz ? nbytes/6 : siz;
+      else {
+	siz = nbytes/4 < siz ? nbytes/4 : siz;
+	if (DOSWAP)
+	  swap4 (buf, siz);
+      }
+      *b->data = buf;
+      *b->size = siz;
+    }
+    close(fd);
+  } else {
+    fp = fopen(fnam, "r");
+    if (!fp)
+      return -1;
+    while (read_param_f(fp, par, &typ, &siz, fmt) == 0) {
+      typ = toupper(typ);
+      b = find_molblock(blocks, lmol, par);
+      if (!b || b->typ != typ || *b->data || siz < 0) {
+	if (skip_block_f(fp, typ, siz, fmt))
+	  break;
+	continue;
+      }
+      buf = calloc(siz+1, typ == 'C' ? 6 : 4);
+      if (!buf)
+	break;
+      if (typ == 'I')
+	read_int4_f (fp, (int *)buf, siz);
+      else if (typ == 'R')
+	read_float4_f (fp, (float *)buf, siz);
+      else
+	read_c6_f (fp, buf, siz, fmt);
+      *b->data = buf;
+      *b->size = siz;
+    }
+    fclose(fp);
+  }
+
+  if (size[1] > INT_MAX/3 || size[4] > INT_MAX/2) {
+    free_molecule (m);
+    return -2;
+  }
+  m->natoms = size[1];
+  m->nres = size[4];
+  if (size[2] != m->natoms) {
+    free (m->b);
+    m->b = NULL;
+  }
+  if (size[3] != m->natoms) {
+    free (m->wt);
+    m->wt = NULL;
+  }
+  if (!m->xyz || !m->atom_name || !m->res_name || !m->res_type || !m->res_ptr ||
+      size[0] != 3*m->natoms || size[5] != m->nres || size[6] != 2*m->nres) {
+    free_molecule (m);
+    return -2;
+  }
+  return check_molecule(m);
+}
+
+/*
+  Check that the residue pointers are within the molecule, and supply
+  default B-factors and occupancies if they are missing. Returns 0 if
+  the molecule is usable, else -2.
+*/
+int check_molecule (odb_molecule *m)
+{
+  register int i;
+
+  for (i=0; i < m->nres; i++) {
+    if (m->res_ptr[2*i] < 1 || m->res_ptr[2*i+1] > m->natoms ||
+	m->res_ptr[2*i] > m->res_ptr[2*i+1] + 1) {
+      free_molecule (m);
+      return -2;
+    }
+  }
+  if (!m->b)
+    m->b = calloc(m->natoms+1, sizeof(float));
+  if (!m->wt) {
+    m->wt = malloc((m->natoms+1)*sizeof(float));
+    for (i=0; m->wt && i < m->natoms; i++)
+      m->wt[i] = 1.0;
+  }
+  if (!m->b || !m->wt) {
+    free_molecule (m);
+    return -2;
+  }
+  return 0;
+}
+
+void free_molecule (odb_molecule *m)
+{
+  free (m->xyz);
+  free (m->b);
+  free (m->wt);
+  free (m->atom_name);
+  free (m->res_name);
+  free (m->res_type);
+  free (m->res_ptr);
+  memset (m, 0, sizeof(odb_molecule));
+}
+
+/*
+  Output is collected in a large buffer, which is written to the file
+  descriptor whenever it fills up.
+*/
+typedef struct {
+  int fd;
+  char *buf, *p;
+  int err;
+} outbuf;
+
+static void flush (outbuf *o)
+{
+  char *q = o->buf;
+  ssize_t n;
+
+  while (q < o->p && !o->err) {
+    n = write (o->fd, q, o->p - q);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      o->err = 1;
+    else
+      q += n;
+  }
+  o->p = o->buf;
+}
+
+/* Make sure there is room for at least 'n' more characters */
+static void reserve (outbuf *o, int n)
+{
+  if (o->p + n > o->buf + OUTBUFSIZ)
+    flush (o);
+}
+
+static char *put_string (char *p, char *s)
+{
+  while (*s)
+    *p++ = *s++;
+  return p;
+}
+
+/*
+  Write integer 'v' right-justified in a field of 'width' characters.
+  A width of 0 writes just the digits.
+*/
+static char *put_int (char *p, long v, int width)
+{
+  char d[24];
+  int n = 0, neg = v < 0;
+  unsigned long u = neg ? -(unsigned long)v : (unsigned long)v;
+
+  do {
+    d[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (neg)
+    d[n++] = '-';
+  for (; width > n; width--)
+    *p++ = ' ';
+  while (n)
+    *p++ = d[--n];
+  return p;
+}
+
+/*
+  Write 'v' with 'prec' decimals, right-justified in a field of
+  'width' characters, like printf("%*.*f"). For prec <= 3 the scaled
+  value is exact in double precision, so rounding agrees with printf.
+  A value that does not fit in the field is clamped to the largest
+  value that does. With a width of 0 any value is written in full,
+  which takes at most FIXEDSIZ characters.
+*/
+static char *put_fixed (char *p, float v, int width, int prec)
+{
+  static const double scale[] = {1.0, 10.0, 100.0, 1000.0};
+  static const double limit[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  char d[FIXEDSIZ];
+  int n = 0, neg;
+  double x, max;
+  long long u;
+
+  if (!isfinite(v)) {
+    for (; width > 3; width--)
+      *p++ = ' ';
+    return put_string (p, isnan(v) ? "nan" : v < 0 ? "-inf" : "inf");
+  }
+  x = nearbyint((double)v * scale[prec]);
+  neg = signbit(v) != 0;
+  if (width > 0) {
+    // the field holds width-prec-1 digits, one of which a sign takes
+    max = limit[width - prec - (neg ? 2 : 1)] * scale[prec] - 1;
+    if (fabs(x) > max)
+      x = max;
+  } else if (fabs(x) >= 1e15) {
+    // beyond the range of long long; these are integers anyway
+    snprintf (d, FIXEDSIZ, "%.*f", prec, (double)v);
+    return put_string (p, d);
+  }
+  u = (long long)fabs(x);
+
+  for (; prec > 0; prec--) {
+    d[n++] = '0' + u % 10;
+    u /= 10;
+  }
+  if (n)
+    d[n++] = '.';
+  do {
+    d[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (neg)
+    d[n++] = '-';
+  for (; width > n; width--)
+    *p++ = ' ';
+  while (n)
+    *p++ = d[--n];
+  return p;
+}
+
+/*
+  Copy an O character variable, without trailing spaces, into 's'.
+  Returns the length.
+*/
+static int c6 (char *s, char *o)
+{
+  int n = 6;
+
+  memcpy (s, o, 6);
+  while (n > 0 && (unsigned char)s[n-1] <= 32)
+    n--;
+  s[n] = '\0';
+  return n;
+}
+
+/*
+  O residue names are free text of up to 6 characters. A name like
+  A123 or A123B is taken to mean chain A, residue 123, insertion code
+  B. If the name contains no number, the residue index is used.
+*/
+static void split_residue (char *name, int index, char *chain, long *seq, char *icode)
+{
+  char *s = name, *e;
+
+  *chain = ' ';
+  *icode = ' ';
+  if (isalpha((unsigned char)*s) && (isdigit((unsigned char)s[1]) || s[1] == '-')) {
+    *chain = *s;
+    s++;
+  }
+  *seq = strtol(s, &e, 10);
+  if (e == s) {
+    *seq = index+1;
+    *chain = ' ';
+  } else if (*e && isalpha((unsigned char)*e) && !e[1]) {
+    *icode = *e;
+  }
+}
+
+/*
+  Guess the element from the atom name. Two-letter elements are only
+  recognized when the atom name equals the residue type, as in the
+  usual ion residues (ZN, FE, MG, CL ...).
+*/
+static void element (char *name, char *restyp, char *el)
+{
+  char *s = name;
+
+  el[0] = ' ';
+  el[1] = ' ';
+  el[2] = '\0';
+  if (strlen(name) == 2 && strcmp(name, restyp) == 0) {
+    el[0] = toupper((unsigned char)name[0]);
+    el[1] = toupper((unsigned char)name[1]);
+    return;
+  }
+  while (*s && !isalpha((unsigned char)*s))
+    s++;
+  if (*s)
+    el[1] = toupper((unsigned char)*s);
+}
+
+/*
+  Write the molecule as PDB ATOM records. Returns the number of atoms
+  written, or -1 on a write error.
+*/
+long write_pdb (int fd, odb_molecule *m)
+{
+  outbuf o;
+  char *p, name[7], restyp[7], resnam[7], el[3], chain = ' ', icode;
+  long seq, serial = 0;
+  int i, j, n;
+
+  o.fd = fd;
+  o.err = 0;
+  o.buf = o.p = malloc(OUTBUFSIZ);
+  if (!o.buf)
+    return -1;
+
+  for (i=0; i < m->nres; i++) {
+    c6 (restyp, m->res_type+6*i);
+    c6 (resnam, m->res_name+6*i);
+    split_residue (resnam, i, &chain, &seq, &icode);
+
+    for (j=m->res_ptr[2*i]-1; j < m->res_ptr[2*i+1]; j++) {
+      reserve (&o, PDBLINE);
+      p = o.p;
+      serial++;
+      n = c6 (name, m->atom_name+6*j);
+      element (name, restyp, el);
+
+      p = put_string (p, "ATOM  ");
+      p = put_int (p, serial % 100000, 5);
+      *p++ = ' ';
+      if (n < 4 && el[0] == ' ')	// atom name starts in column 14
+	*p++ = ' ';
+      p = put_string (p, name);
+      while (p < o.p + 16)
+	*p++ = ' ';
+      p = o.p + 16;			// truncate long atom names
+      *p++ = ' ';
+      n = strlen(restyp);
+      for (; n < 3; n++)
+	*p++ = ' ';
+      p = put_string (p, restyp);
+      p = o.p + 20;
+      *p++ = ' ';
+      *p++ = chain;
+      p = put_int (p, seq, 4);
+      p = o.p + 26;
+      *p++ = icode;
+      p = put_string (p, "   ");
+      p = put_fixed (p, m->xyz[3*j], 8, 3);
+      p = put_fixed (p, m->xyz[3*j+1], 8, 3);
+      p = put_fixed (p, m->xyz[3*j+2], 8, 3);
+      p = put_fixed (p, m->wt[j], 6, 2);
+      p = put_fixed (p, m->b[j], 6, 2);
+      p = put_string (p, "          ");
+      p = put_string (p, el);
+      *p++ = '\n';
+      o.p = p;
+    }
+  }
+  reserve (&o, PDBLINE);
+  if (m->nres > 0) {
+    o.p = put_string (o.p, "TER   ");
+    o.p = put_int (o.p, (serial+1) % 100000, 5);
+    o.p = put_string (o.p, "      ");
+    for (n = strlen(restyp); n < 3; n++)
+      *o.p++ = ' ';
+    o.p = put_string (o.p, restyp);
+    *o.p++ = ' ';
+    *o.p++ = chain;
+    o.p = put_int (o.p, seq, 4);
+    *o.p++ = '\n';
+  }
+  o.p = put_string (o.p, "END\n");
+  flush (&o);
+  free (o.buf);
+  return o.err ? -1 : serial;
+}
+
+/*
+  Write a CIF value, quoting it if necessary.
+*/
+static char *put_cif (char *p, char *s)
+{
+  if (!*s)
+    return put_string (p, ".");
+  if (strchr(s, '\'') || strchr(s, ' ') || *s == '_' || *s == '#' || *s == '$'
+      || *s == '"' || *s == ';' || *s == '[' || *s == ']') {
+    *p++ = '"';
+    p = put_string (p, s);
+    *p++ = '"';
+    return p;
+  }
+  return put_string (p, s);
+}
+
+/*
+  Write the molecule as an mmCIF atom_site loop. Returns the number of
+  atoms written, or -1 on a write error.
+*/
+long write_mmcif (int fd, char *mol, odb_molecule *m)
+{
+  outbuf o;
+  char *p, name[7], restyp[7], resnam[7], el[3], chain, icode, asym[2];
+  long seq, serial = 0;
+  int i, j;
+
+  o.fd = fd;
+  o.err = 0;
+  o.buf = o.p = malloc(OUTBUFSIZ);
+  if (!o.buf)
+    return -1;
+
+  o.p = put_string (o.p, "data_");
+  for (i=0; mol[i] && i < 25; i++)
+    *o.p++ = isspace((unsigned char)mol[i]) ? '_' : toupper((unsigned char)mol[i]);
+  o.p = put_string (o.p, "\n#\nloop_\n"
+		    "_atom_site.group_PDB\n"
+		    "_atom_site.id\n"
+		    "_atom_site.type_symbol\n"
+		    "_atom_site.label_atom_id\n"
+		    "_atom_site.label_alt_id\n"
+		    "_atom_site.label_comp_id\n"
+		    "_atom_site.label_asym_id\n"
+		    "_atom_site.label_seq_id\n"
+		    "_atom_site.pdbx_PDB_ins_code\n"
+		    "_atom_site.Cartn_x\n"
+		    "_atom_site.Cartn_y\n"
+		    "_atom_site.Cartn_z\n"
+		    "_atom_site.occupancy\n"
+		    "_atom_site.B_iso_or_equiv\n"
+		    "_atom_site.auth_seq_id\n"
+		    "_atom_site.auth_asym_id\n"
+		    "_atom_site.pdbx_PDB_model_num\n");
+
+  asym[1] = '\0';
+  for (i=0; i < m->nres; i++) {
+    c6 (restyp, m->res_type+6*i);
+    c6 (resnam, m->res_name+6*i);
+    split_residue (resnam, i, &chain, &seq, &icode);
+    asym[0] = chain == ' ' ? 'A' : chain;
+
+    for (j=m->res_ptr[2*i]-1; j < m->res_ptr[2*i+1]; j++) {
+      reserve (&o, CIFLINE);
+      p = o.p;
+      serial++;
+      c6 (name, m->atom_name+6*j);
+      element (name, restyp, el);
+
+      p = put_string (p, "ATOM ");
+      p = put_int (p, serial, 0);
+      *p++ = ' ';
+      p = put_cif (p, el[0] == ' ' ? el+1 : el);
+      *p++ = ' ';
+      p = put_cif (p, name);
+      p = put_string (p, " . ");
+      p = put_cif (p, restyp);
+      *p++ = ' ';
+      p = put_string (p, asym);
+      *p++ = ' ';
+      p = put_int (p, i+1, 0);
+      *p++ = ' ';
+      *p++ = icode == ' ' ? '?' : icode;
+      *p++ = ' ';
+      p = put_fixed (p, m->xyz[3*j], 0, 3);
+      *p++ = ' ';
+      p = put_fixed (p, m->xyz[3*j+1], 0, 3);
+      *p++ = ' ';
+      p = put_fixed (p, m->xyz[3*j+2], 0, 3);
+      *p++ = ' ';
+      p = put_fixed (p, m->wt[j], 0, 2);
+      *p++ = ' ';
+      p = put_fixed (p, m->b[j], 0, 2);
+      *p++ = ' ';
+      p = put_int (p, seq, 0);
+      *p++ = ' ';
+      p = put_string (p, asym);
+      p = put_string (p, " 1\n");
+      o.p = p;
+    }
+  }
+  reserve (&o, 4);
+  o.p = put_string (o.p, "#\n");
+  flush (&o);
+  free (o.buf);
+  return o.err ? -1 : serial;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
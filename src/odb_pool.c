@@ -0,0 +1,119 @@
+/*
+   A small pool of threads for reading O files in the background.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+
+   The threads are started when the first task is submitted, and wait
+   for tasks for the lifetime of the process. After a fork, the child
+   starts its own threads.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "odb_io.h"
+
+#define POOL_THREADS 4
+
+typedef struct pool_task {
+  void (*work) (void *);
+  void *arg;
+  struct pool_task *next;
+} pool_task;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pool_task *head = NULL, *tail = NULL;
+static int nthreads = 0;
+
+static void *pool_worker (void *unused)
+{
+  pool_task *t;
+
+  (void) unused;
+  while (1) {
+    pthread_mutex_lock (&pool_lock);
+    while (!head)
+      pthread_cond_wait (&pool_wake, &pool_lock);
+    t = head;
+    head = t->next;
+    if (!head)
+      tail = NULL;
+    pthread_mutex_unlock (&pool_lock);
+
+    t->work (t->arg);
+    free (t);
+  }
+  return NULL;
+}
+
+/*
+  The threads of the parent do not exist in a forked child, and the
+  tasks queued there will never be run by it.
+*/
+static void pool_atfork_child (void)
+{
+  pthread_mutex_init (&pool_lock, NULL);
+  pthread_cond_init (&pool_wake, NULL);
+  head = tail = NULL;
+  nthreads = 0;
+}
+
+static int pool_start (void)
+{
+  static int registered = 0;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  if (!registered) {
+    pthread_atfork (NULL, NULL, pool_atfork_child);
+    registered = 1;
+  }
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  while (nthreads < POOL_THREADS) {
+    if (pthread_create (&thread, &attr, pool_worker, NULL) != 0)
+      break;
+    nthreads++;
+  }
+  pthread_attr_destroy (&attr);
+  return nthreads > 0 ? 0 : -1;
+}
+
+/*
+  Run work(arg) on one of the threads of the pool. Returns -1 if no
+  thread could be started.
+*/
+int pool_submit (void (*work) (void *), void *arg)
+{
+  pool_task *t;
+
+  t = malloc (sizeof(pool_task));
+  if (!t)
+    return -1;
+  t->work = work;
+  t->arg = arg;
+  t->next = NULL;
+
+  pthread_mutex_lock (&pool_lock);
+  if (nthreads == 0 && pool_start () < 0) {
+    pthread_mutex_unlock (&pool_lock);
+    free (t);
+    return -1;
+  }
+  if (tail)
+    tail->next = t;
+  else
+    head = t;
+  tail = t;
+  pthread_cond_signal (&pool_wake);
+  pthread_mutex_unlock (&pool_lock);
+  return 0;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
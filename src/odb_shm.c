@@ -0,0 +1,488 @@
+/*
+   Shared memory cache of decoded O files.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+
+   The first process to read an O file through the cache decodes it
+   into a POSIX shared memory segment, with integers and reals in
+   native byte order. Later processes map the segment read-only
+   instead of reading the file. The segment is named after the user
+   and a hash of the absolute path of the file, and the header records
+   the device, inode, modification time and size of the file it was
+   made from. If the file has changed, or has been replaced by another
+   under the same name, the segment is unlinked and made again;
+   processes that still have the old segment mapped are not affected.
+
+   A second object, named like the segment with ".lock" appended,
+   serializes the processes. Segments are only made and unlinked under
+   an exclusive lock on it, and processes attaching take a shared
+   lock, so they never see a segment being made. The lock object is
+   removed with the segment; a process that was waiting for it then
+   finds that it has locked an object no longer in use, and starts
+   again. A segment that is found incomplete was left by a process
+   that died while making it, and is made again.
+
+   The names can be guessed, and /dev/shm is writable by everyone, so
+   an object is only used if it belongs to the user and nobody else
+   can read or write it, and the table of datablocks of a segment is
+   checked before anything in it is used. Otherwise the file is read
+   as usual.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "odb_io.h"
+
+#define SHM_MAGIC "ODBSHM02"
+#define SHM_ALIGN 64
+
+static int64_t align (int64_t n)
+{
+  return (n + SHM_ALIGN - 1) & ~(int64_t)(SHM_ALIGN - 1);
+}
+
+/*
+  Make the name of the segment for file 'fnam'. Returns -1 if the file
+  does not exist.
+*/
+static int shm_name (char *fnam, char *name)
+{
+  char *path;
+  uint64_t h;
+
+  path = realpath (fnam, NULL);
+  if (!path)
+    return -1;
+  h = hash_bytes (0, path, strlen(path));
+  free (path);
+  sprintf (name, "/odbparser.%u.%016llx", (unsigned)geteuid(), (unsigned long long)h);
+  return 0;
+}
+
+/* Take, change or release the lock 'op' on 'fd' */
+static int lock (int fd, int op)
+{
+  while (flock (fd, op) < 0)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+/*
+  Return 1 if the shared memory object 'fd' belongs to the user, and
+  nobody else has access to it. Its status is returned in 'st'.
+*/
+static int owned (int fd, struct stat *st)
+{
+  return fstat (fd, st) == 0 && st->st_uid == geteuid() && (st->st_mode & 077) == 0;
+}
+
+/*
+  Open the lock object of segment 'name', and lock it with 'op'. If
+  the object was removed while waiting for the lock, start again with
+  the one now under that name. Returns the file descriptor, or -1.
+*/
+static int shm_lock (char *name, int op)
+{
+  char lockname[80];
+  struct stat st, now;
+  int fd, cur, same;
+
+  sprintf (lockname, "%s.lock", name);
+  while (1) {
+    fd = shm_open (lockname, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+      return -1;
+    if (!owned (fd, &st) || lock (fd, op) < 0) {
+      close (fd);
+      return -1;
+    }
+    cur = shm_open (lockname, O_RDONLY, 0);
+    same = cur >= 0 && fstat (cur, &now) == 0 &&
+      now.st_dev == st.st_dev && now.st_ino == st.st_ino;
+    if (cur >= 0)
+      close (cur);
+    if (same)
+      return fd;
+    close (fd);
+  }
+}
+
+/*
+  Release the lock 'fd' of segment 'name'. If 'remove' is set, the
+  caller holds the exclusive lock, and the lock object is removed.
+*/
+static void shm_unlock (char *name, int fd, int remove)
+{
+  char lockname[80];
+
+  if (remove) {
+    sprintf (lockname, "%s.lock", name);
+    shm_unlink (lockname);
+  }
+  lock (fd, LOCK_UN);
+  close (fd);
+}
+
+/*
+  Return 1 if 'a' and 'b' are the status of the same, unchanged file.
+*/
+int same_file (struct stat *a, struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+    a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+    a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+  Decode the datablocks of a binary file into the segment.
+*/
+static int fill_binary (char *fnam, odb_entry *list, odb_shm_block *blocks, int n,
+			char *base, volatile int *cancel)
+{
+  int fd, i, err = 0;
+  odb_entry *e;
+  char *data;
+
+  fd = open (fnam, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  for (i=0; i<n && !err; i++) {
+    if (cancel && *cancel) {
+      err = -1;
+      break;
+    }
+    e = &list[i];
+    data = base + blocks[i].offset;
+    if (lseek (fd, e->src, SEEK_SET) < 0) {
+      err = -1;
+      break;
+    }
+    switch (e->typ) {
+    case 'I':
+      err = read_int4 (fd, (int *)data, e->size, DOSWAP);
+      break;
+    case 'R':
+      err = read_float4 (fd, (float *)data, e->size, DOSWAP);
+      break;
+    case 'C':
+      err = read_c6 (fd, data, e->size, DOSWAP);
+      break;
+    case 'T':
+      err = read_text (fd, data, e->size, DOSWAP);
+      break;
+    }
+  }
+  close (fd);
+  return err;
+}
+
+/*
+  Decode the datablocks of a formatted file into the segment.
+*/
+static int fill_formatted (char *fnam, odb_entry *list, odb_shm_block *blocks, int n,
+			   char *base, volatile int *cancel)
+{
+  FILE *fp;
+  int i, err = 0;
+  odb_entry *e;
+  char *data;
+
+  fp = fopen (fnam, "r");
+  if (!fp)
+    return -1;
+  for (i=0; i<n && !err; i++) {
+    if (cancel && *cancel) {
+      err = -1;
+      break;
+    }
+    e = &list[i];
+    data = base + blocks[i].offset;
+    if (fseeko (fp, e->src, SEEK_SET) < 0) {
+      err = -1;
+      break;
+    }
+    switch (e->typ) {
+    case 'I':
+      err = read_int4_f (fp, (int *)data, e->size);
+      break;
+    case 'R':
+      err = read_float4_f (fp, (float *)data, e->size);
+      break;
+    case 'C':
+      err = read_c6_f (fp, data, e->size, e->fmt);
+      break;
+    case 'T':
+      err = read_text_f (fp, data, e->size, e->reclen) < e->size * e->reclen;
+      break;
+    }
+  }
+  fclose (fp);
+  return err;
+}
+
+/*
+  Find the datablocks of an O file, and the length in bytes of the
+  image holding them decoded. The number of datablocks is returned in
+  'n', or -1 on error.
+*/
+odb_entry *image_scan (char *fnam, int binary, int *n, int64_t *length)
+{
+  odb_entry *list;
+  int i;
+
+  list = binary ? scan_binary_file (fnam, n) : scan_formatted_file (fnam, n);
+  if (*n < 0)
+    return NULL;
+  *length = align (sizeof(odb_shm_header) + *n * sizeof(odb_shm_block));
+  for (i=0; i < *n; i++)
+    *length = align (*length + list[i].nbytes);
+  return list;
+}
+
+/*
+  Decode the 'n' datablocks found by image_scan into the image 'hdr'
+  of 'length' bytes. If 'cancel' is given and becomes set by another
+  thread, decoding stops before the next datablock. Returns 0 on
+  success.
+*/
+int image_fill (odb_shm_header *hdr, int64_t length, char *fnam, int binary,
+		odb_entry *list, int n, volatile int *cancel)
+{
+  odb_shm_block *blocks;
+  int64_t offset;
+  int i;
+
+  memset (hdr, 0, sizeof(odb_shm_header));
+  memcpy (hdr->magic, SHM_MAGIC, 8);
+  hdr->nblocks = n;
+  hdr->binary = binary;
+  hdr->length = length;
+  blocks = (odb_shm_block *)(hdr + 1);
+  offset = align (sizeof(odb_shm_header) + n * sizeof(odb_shm_block));
+  for (i=0; i<n; i++) {
+    memset (&blocks[i], 0, sizeof(odb_shm_block));
+    memcpy (blocks[i].name, list[i].name, 26);
+    blocks[i].typ = list[i].typ;
+    blocks[i].reclen = list[i].reclen;
+    blocks[i].size = list[i].size;
+    blocks[i].nbytes = list[i].nbytes;
+    blocks[i].offset = offset;
+    offset = align (offset + list[i].nbytes);
+  }
+
+  if (binary)
+    return fill_binary (fnam, list, blocks, n, (char *)hdr, cancel);
+  return fill_formatted (fnam, list, blocks, n, (char *)hdr, cancel);
+}
+
+/*
+  Decode the file into the newly created segment 'shmfd'. The caller
+  holds the exclusive lock. 'st' is the status of the file before it
+  was read; if it has changed by the time the segment is complete, the
+  segment is not used. Returns the segment mapped read-only.
+*/
+static odb_shm_header *shm_build (int shmfd, char *fnam, int binary, struct stat *st)
+{
+  odb_entry *list;
+  odb_shm_header *hdr;
+  struct stat after;
+  int n, err;
+  int64_t length;
+
+  list = image_scan (fnam, binary, &n, &length);
+  if (n < 0)
+    return NULL;
+  if (ftruncate (shmfd, length) < 0) {
+    free (list);
+    return NULL;
+  }
+  hdr = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+  if (hdr == MAP_FAILED) {
+    free (list);
+    return NULL;
+  }
+
+  err = image_fill (hdr, length, fnam, binary, list, n, NULL);
+  free (list);
+  if (err || stat (fnam, &after) < 0 || !same_file (st, &after)) {
+    munmap (hdr, length);
+    return NULL;
+  }
+  hdr->dev = st->st_dev;
+  hdr->ino = st->st_ino;
+  hdr->mtime = st->st_mtim.tv_sec;
+  hdr->mtime_nsec = st->st_mtim.tv_nsec;
+  hdr->filesize = st->st_size;
+  hdr->ready = 1;
+  mprotect (hdr, length, PROT_READ);
+  return hdr;
+}
+
+/*
+  Check the table of datablocks of the segment 'hdr' of 'length'
+  bytes: every datablock must lie within the segment, after the
+  table, and its length must agree with its size and type. Returns 1
+  if it does.
+*/
+static int shm_valid (odb_shm_header *hdr, int64_t length)
+{
+  odb_shm_block *b;
+  int64_t start, w;
+  int i;
+
+  if (hdr->nblocks < 0 || (hdr->binary != 0 && hdr->binary != 1) ||
+      hdr->nblocks > (length - (int64_t)sizeof(odb_shm_header)) / (int64_t)sizeof(odb_shm_block))
+    return 0;
+  start = sizeof(odb_shm_header) + hdr->nblocks * sizeof(odb_shm_block);
+  b = (odb_shm_block *)(hdr + 1);
+  for (i=0; i < hdr->nblocks; i++, b++) {
+    if (!memchr (b->name, '\0', 26))
+      return 0;
+    switch (b->typ) {
+    case 'I':
+    case 'R':
+      w = 4;
+      break;
+    case 'C':
+      w = 6;
+      break;
+    case 'T':
+      w = b->reclen ? b->reclen : 1;
+      break;
+    default:
+      return 0;
+    }
+    if (b->reclen < 0 || (b->reclen && b->typ != 'T') ||
+	b->size < 0 || b->size > length / w || b->nbytes != b->size * w ||
+	b->offset < start || b->offset % SHM_ALIGN != 0 ||
+	b->offset > length - b->nbytes)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+  Map segment 'name', and check that it is complete and was made from
+  the file with status 'st'. Returns NULL if it is not.
+*/
+static odb_shm_header *shm_map (char *name, struct stat *st)
+{
+  struct stat sst;
+  odb_shm_header *hdr;
+  int shmfd;
+
+  shmfd = shm_open (name, O_RDONLY, 0);
+  if (shmfd < 0)
+    return NULL;
+  if (!owned (shmfd, &sst) || sst.st_size < (off_t)sizeof(odb_shm_header)) {
+    close (shmfd);
+    return NULL;
+  }
+  hdr = mmap (NULL, sst.st_size, PROT_READ, MAP_SHARED, shmfd, 0);
+  close (shmfd);
+  if (hdr == MAP_FAILED)
+    return NULL;
+  if (memcmp (hdr->magic, SHM_MAGIC, 8) != 0 || !hdr->ready ||
+      hdr->length != sst.st_size ||
+      hdr->dev != (int64_t)st->st_dev ||
+      hdr->ino != (int64_t)st->st_ino ||
+      hdr->mtime != st->st_mtim.tv_sec ||
+      hdr->mtime_nsec != st->st_mtim.tv_nsec ||
+      hdr->filesize != st->st_size ||
+      !shm_valid (hdr, sst.st_size)) {
+    munmap (hdr, sst.st_size);
+    return NULL;
+  }
+  return hdr;
+}
+
+/*
+  Return the decoded contents of the O file 'fnam', mapped read-only
+  from shared memory. The segment is made if it does not exist or is
+  out of date. Returns NULL if shared memory cannot be used, and the
+  caller should then read the file itself.
+*/
+odb_shm_header *shm_attach (char *fnam, int binary)
+{
+  struct stat st;
+  char name[64];
+  int lockfd, shmfd;
+  odb_shm_header *hdr;
+
+  if (stat (fnam, &st) < 0 || shm_name (fnam, name) < 0)
+    return NULL;
+  lockfd = shm_lock (name, LOCK_SH);
+  if (lockfd < 0)
+    return NULL;
+
+  hdr = shm_map (name, &st);
+  if (hdr) {
+    shm_unlock (name, lockfd, 0);
+    return hdr;
+  }
+
+  // the lock object may be removed while it is changed to exclusive
+  shm_unlock (name, lockfd, 0);
+  lockfd = shm_lock (name, LOCK_EX);
+  if (lockfd < 0)
+    return NULL;
+  // another process may have made it while the lock was released
+  hdr = shm_map (name, &st);
+  if (!hdr) {
+    shm_unlink (name);		// stale or incomplete
+    shmfd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shmfd >= 0) {
+      hdr = shm_build (shmfd, fnam, binary, &st);
+      close (shmfd);
+      if (!hdr)
+	shm_unlink (name);
+    }
+  }
+  // nothing is left to lock if the segment could not be made
+  shm_unlock (name, lockfd, hdr == NULL);
+  return hdr;
+}
+
+/*
+  Unmap a segment returned by shm_attach.
+*/
+void shm_detach (odb_shm_header *hdr)
+{
+  munmap (hdr, hdr->length);
+}
+
+/*
+  Remove the segment holding the file 'fnam', and its lock object.
+  Processes that have it mapped keep their mapping.
+*/
+int shm_remove (char *fnam)
+{
+  char name[64];
+  int lockfd, err, saved;
+
+  if (shm_name (fnam, name) < 0)
+    return -1;
+  lockfd = shm_lock (name, LOCK_EX);
+  if (lockfd < 0)
+    return -1;
+  err = shm_unlink (name);
+  saved = errno;
+  shm_unlock (name, lockfd, 1);
+  errno = saved;
+  return err;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
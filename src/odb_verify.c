@@ -0,0 +1,308 @@
+/*
+   Verification of binary O files: record framing and CRC32C
+   checksums of the datablocks.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "odb_io.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <nmmintrin.h>
+#  define CRC_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define CRC_ARM 1
+#endif
+
+#define CRC_CHUNK (1<<20)
+
+/*
+  CRC32C (Castagnoli) in software, one byte at a time.
+*/
+static uint32_t crc_table[256];
+static int crc_hw;			/* the processor computes CRC32C */
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*
+  Run once, by pthread_once, which makes the table and crc_hw visible
+  to every thread that calls crc32c.
+*/
+static void crc_init (void)
+{
+  uint32_t c;
+  int i, k;
+
+#if CRC_SSE42
+  crc_hw = __builtin_cpu_supports("sse4.2") != 0;
+#elif CRC_ARM
+  crc_hw = 1;
+#endif
+  for (i=0; i<256; i++) {
+    c = i;
+    for (k=0; k<8; k++)
+      c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    crc_table[i] = c;
+  }
+}
+
+static uint32_t crc32c_sw (uint32_t crc, const unsigned char *buf, int64_t n)
+{
+  while (n--)
+    crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if CRC_SSE42
+/*
+  The SSE4.2 crc32 instruction computes CRC32C, 8 bytes at a time. It
+  is compiled for SSE4.2 regardless of the compiler flags, and only
+  used if the processor has it.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw (uint32_t crc, const unsigned char *buf, int64_t n)
+{
+  uint64_t c, w;
+
+  for (; n > 0 && ((uintptr_t)buf & 7); n--)
+    crc = _mm_crc32_u8(crc, *buf++);
+  c = crc;
+  for (; n >= 8; n -= 8, buf += 8) {
+    memcpy (&w, buf, 8);
+    c = _mm_crc32_u64(c, w);
+  }
+  crc = c;
+  for (; n > 0; n--)
+    crc = _mm_crc32_u8(crc, *buf++);
+  return crc;
+}
+#elif CRC_ARM
+static uint32_t crc32c_hw (uint32_t crc, const unsigned char *buf, int64_t n)
+{
+  uint64_t w;
+
+  for (; n > 0 && ((uintptr_t)buf & 7); n--)
+    crc = __crc32cb(crc, *buf++);
+  for (; n >= 8; n -= 8, buf += 8) {
+    memcpy (&w, buf, 8);
+    crc = __crc32cd(crc, w);
+  }
+  for (; n > 0; n--)
+    crc = __crc32cb(crc, *buf++);
+  return crc;
+}
+#endif
+
+/*
+  Update the CRC32C 'crc' with 'n' bytes. Start with crc = 0.
+*/
+uint32_t crc32c (uint32_t crc, const char *buf, int64_t n)
+{
+  pthread_once (&crc_once, crc_init);
+#if CRC_SSE42 || CRC_ARM
+  if (crc_hw)
+    return ~crc32c_hw (~crc, (const unsigned char *)buf, n);
+#endif
+  return ~crc32c_sw (~crc, (const unsigned char *)buf, n);
+}
+
+/*
+  Check the framing of the fortran record at 'offset', which may be
+  split into subrecords, without reading its contents. All of it must
+  lie within the file, and the leading and trailing lengths of every
+  subrecord must agree. Returns the length of the record, and the
+  offset of the next record in 'next', or -1 if the framing is broken.
+*/
+static int64_t check_record (int fd, off_t offset, off_t filesize, off_t *next)
+{
+  int32_t rl1, rl2;
+  int64_t len, total = 0;
+  int more;
+
+  do {
+    if (offset + 4 > filesize || pread_full (fd, &rl1, 4, offset) != 4)
+      return -1;
+    if (DOSWAP) swap4 ((char *)&rl1, 1);
+    more = rl1 < 0;
+    len = rl1 < 0 ? -(int64_t)rl1 : rl1;
+    if (offset + 8 + len > filesize ||
+	pread_full (fd, &rl2, 4, offset + 4 + len) != 4)
+      return -1;
+    if (DOSWAP) swap4 ((char *)&rl2, 1);
+    if ((rl2 < 0 ? -(int64_t)rl2 : rl2) != len)
+      return -1;
+    total += len;
+    offset += len + 8;
+  } while (more);
+
+  *next = offset;
+  return total;
+}
+
+/*
+  Check the framing of every record of a binary O file against the
+  file size, and that the length of every data record matches the
+  size given in its header, before anything is decoded. The
+  datablocks are returned in 'list' and their number in 'n'. If
+  'fst' is given, the status of the file checked is returned in it,
+  so the caller can tell if the file changes before it is decoded.
+  Returns 0 if the file is sound, otherwise -1 with the reason in
+  'msg', which must hold 256 characters.
+*/
+int verify_framing (char *fnam, odb_entry **list, int *n, struct stat *fst, char *msg)
+{
+  int fd, i, nalloc = 0, err = -1;
+  struct stat st;
+  off_t offset = 0, next;
+  int64_t len, expect;
+  int32_t siz;
+  char buf[30], par[26], typ, *s;
+  odb_entry *e;
+
+  *list = NULL;
+  *n = 0;
+  fd = open (fnam, O_RDONLY);
+  if (fd < 0 || fstat (fd, &st) < 0) {
+    snprintf (msg, 256, "%s: %s", fnam, strerror(errno));
+    if (fd >= 0)
+      close (fd);
+    return -1;
+  }
+  if (fst)
+    *fst = st;
+
+  while (1) {
+    if (offset == st.st_size) {
+      err = 0;
+      break;
+    }
+    len = check_record (fd, offset, st.st_size, &next);
+    if (len != 30) {
+      snprintf (msg, 256, "%s: broken datablock header at offset %lld",
+		fnam, (long long)offset);
+      break;
+    }
+    pread_record (fd, offset, buf, 0, 30, DOSWAP);
+    for (i=0; i<25; i++)
+      par[i] = tolower(buf[i]);
+    par[25] = '\0';
+    s = &par[25];
+    while (*s <= 32 && s > par)
+      *s-- = '\0';
+    typ = buf[25];
+    memcpy (&siz, buf+26, 4);
+    if (DOSWAP) swap4 ((char *)&siz, 1);
+    if (siz == 0) {
+      // end of the datablocks, as in readbinary
+      err = 0;
+      break;
+    }
+    if (siz < 0) {
+      snprintf (msg, 256, "%s: datablock %s has invalid size %d", fnam, par, siz);
+      break;
+    }
+
+    switch (typ) {
+    case 'I':
+    case 'R':
+      expect = 4 * (int64_t)siz;
+      break;
+    case 'C':
+      expect = 6 * (int64_t)siz;
+      break;
+    case 'T':
+      expect = siz;
+      break;
+    default:
+      expect = -1;
+    }
+    if (expect < 0) {
+      snprintf (msg, 256, "%s: datablock %s has unknown type '%c'", fnam, par, typ);
+      break;
+    }
+
+    offset = next;
+    len = check_record (fd, offset, st.st_size, &next);
+    if (len < 0) {
+      snprintf (msg, 256, "%s: datablock %s: data record at offset %lld is "
+		"truncated or corrupt", fnam, par, (long long)offset);
+      break;
+    }
+    if (len != expect) {
+      snprintf (msg, 256, "%s: datablock %s: data record is %lld bytes, "
+		"expected %lld", fnam, par, (long long)len, (long long)expect);
+      break;
+    }
+
+    e = add_entry (list, n, &nalloc);
+    if (!e) {
+      snprintf (msg, 256, "%s: out of memory", fnam);
+      break;
+    }
+    memcpy (e->name, par, 26);
+    e->typ = typ;
+    e->size = siz;
+    e->nbytes = len;
+    e->src = offset;
+    offset = next;
+  }
+  close (fd);
+
+  if (err) {
+    free (*list);
+    *list = NULL;
+  }
+  return err;
+}
+
+/*
+  Compute the CRC32C of the data of each of the 'n' datablocks in
+  'list', as stored in the file, and store it in 'crc'. Returns 0 on
+  success.
+*/
+int verify_crc (char *fnam, odb_entry *list, int n, uint32_t *crc)
+{
+  int fd, i;
+  int64_t done, k;
+  char *buf;
+
+  fd = open (fnam, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  buf = malloc (CRC_CHUNK);
+  if (!buf) {
+    close (fd);
+    return -1;
+  }
+  for (i=0; i<n; i++) {
+    crc[i] = 0;
+    for (done=0; done < list[i].nbytes; done += k) {
+      k = list[i].nbytes - done < CRC_CHUNK ? list[i].nbytes - done : CRC_CHUNK;
+      if (pread_record (fd, list[i].src, buf, done, k, DOSWAP) != k) {
+	free (buf);
+	close (fd);
+	return -1;
+      }
+      crc[i] = crc32c (crc[i], buf, k);
+    }
+  }
+  free (buf);
+  close (fd);
+  return 0;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
@@ -0,0 +1,375 @@
+/*
+   Routines to write formatted O files.
+   Copyright (C) Morten Kjeldgaard 2026.
+   Licence: GPL.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <inttypes.h>
+#include "odb_io.h"
+
+/*
+  Shortest round-trip formatting of single precision floats, after
+  Ulf Adams, "Ryu: fast float-to-string conversion", PLDI 2018. The
+  tables hold 5^-q and 5^i scaled to 59 and 61 bits, respectively.
+*/
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+static const uint64_t FLOAT_POW5_INV_SPLIT[31] = {
+  576460752303423489u, 461168601842738791u, 368934881474191033u,
+  295147905179352826u, 472236648286964522u, 377789318629571618u,
+  302231454903657294u, 483570327845851670u, 386856262276681336u,
+  309485009821345069u, 495176015714152110u, 396140812571321688u,
+  316912650057057351u, 507060240091291761u, 405648192073033409u,
+  324518553658426727u, 519229685853482763u, 415383748682786211u,
+  332306998946228969u, 531691198313966350u, 425352958651173080u,
+  340282366920938464u, 544451787073501542u, 435561429658801234u,
+  348449143727040987u, 557518629963265579u, 446014903970612463u,
+  356811923176489971u, 570899077082383953u, 456719261665907162u,
+  365375409332725730u
+};
+
+static const uint64_t FLOAT_POW5_SPLIT[47] = {
+  1152921504606846976u, 1441151880758558720u, 1801439850948198400u,
+  2251799813685248000u, 1407374883553280000u, 1759218604441600000u,
+  2199023255552000000u, 1374389534720000000u, 1717986918400000000u,
+  2147483648000000000u, 1342177280000000000u, 1677721600000000000u,
+  2097152000000000000u, 1310720000000000000u, 1638400000000000000u,
+  2048000000000000000u, 1280000000000000000u, 1600000000000000000u,
+  2000000000000000000u, 1250000000000000000u, 1562500000000000000u,
+  1953125000000000000u, 1220703125000000000u, 1525878906250000000u,
+  1907348632812500000u, 1192092895507812500u, 1490116119384765625u,
+  1862645149230957031u, 1164153218269348144u, 1455191522836685180u,
+  1818989403545856475u, 2273736754432320594u, 1421085471520200371u,
+  1776356839400250464u, 2220446049250313080u, 1387778780781445675u,
+  1734723475976807094u, 2168404344971008868u, 1355252715606880542u,
+  1694065894508600678u, 2117582368135750847u, 1323488980084844279u,
+  1654361225106055349u, 2067951531382569187u, 1292469707114105741u,
+  1615587133892632177u, 2019483917365790221u
+};
+
+static int pow5bits (int e)
+{
+  return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static uint32_t log10pow2 (int e)
+{
+  return ((uint32_t)e * 78913) >> 18;
+}
+
+static uint32_t log10pow5 (int e)
+{
+  return ((uint32_t)e * 732923) >> 20;
+}
+
+static int pow5factor (uint32_t value)
+{
+  int count = 0;
+
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count;
+}
+
+static uint32_t mulshift (uint32_t m, uint64_t factor, int shift)
+{
+  uint64_t bits0 = (uint64_t)m * (uint32_t)factor;
+  uint64_t bits1 = (uint64_t)m * (uint32_t)(factor >> 32);
+
+  return (uint32_t)(((bits0 >> 32) + bits1) >> (shift - 32));
+}
+
+/*
+  Compute the shortest decimal digits 'digits' and exponent 'e10' such
+  that digits*10^e10 reads back as the float with the given mantissa
+  and exponent bits.
+*/
+static void f2d (uint32_t mantissa, uint32_t exponent, uint32_t *digits, int *e10)
+{
+  int e2, q, i, j, k, removed = 0;
+  uint32_t m2, mv, mp, mm, mmshift, vr, vp, vm;
+  int accept, vmzeros = 0, vrzeros = 0;
+  unsigned lastdigit = 0;
+
+  if (exponent == 0) {
+    e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+    m2 = mantissa;
+  } else {
+    e2 = (int)exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+    m2 = (1u << FLOAT_MANTISSA_BITS) | mantissa;
+  }
+  accept = (m2 & 1) == 0;
+
+  /* Step 2: the interval of valid decimal representations */
+  mv = 4 * m2;
+  mp = 4 * m2 + 2;
+  mmshift = mantissa != 0 || exponent <= 1;
+  mm = 4 * m2 - 1 - mmshift;
+
+  /* Step 3: convert to a decimal power base */
+  if (e2 >= 0) {
+    q = log10pow2(e2);
+    *e10 = q;
+    k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+    i = -e2 + q + k;
+    vr = mulshift(mv, FLOAT_POW5_INV_SPLIT[q], i);
+    vp = mulshift(mp, FLOAT_POW5_INV_SPLIT[q], i);
+    vm = mulshift(mm, FLOAT_POW5_INV_SPLIT[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+      lastdigit = mulshift(mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + q - 1 + k) % 10;
+    }
+    if (q <= 9) {
+      if (mv % 5 == 0)
+	vrzeros = pow5factor(mv) >= q;
+      else if (accept)
+	vmzeros = pow5factor(mm) >= q;
+      else
+	vp -= pow5factor(mp) >= q;
+    }
+  } else {
+    q = log10pow5(-e2);
+    *e10 = q + e2;
+    i = -e2 - q;
+    k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+    j = q - k;
+    vr = mulshift(mv, FLOAT_POW5_SPLIT[i], j);
+    vp = mulshift(mp, FLOAT_POW5_SPLIT[i], j);
+    vm = mulshift(mm, FLOAT_POW5_SPLIT[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = q - 1 - (pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+      lastdigit = mulshift(mv, FLOAT_POW5_SPLIT[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      vrzeros = 1;
+      if (accept)
+	vmzeros = mmshift == 1;
+      else
+	vp--;
+    } else if (q < 31) {
+      vrzeros = (mv & ((1u << (q - 1)) - 1)) == 0;
+    }
+  }
+
+  /* Step 4: find the shortest representation in the interval */
+  if (vmzeros || vrzeros) {
+    while (vp / 10 > vm / 10) {
+      vmzeros &= vm % 10 == 0;
+      vrzeros &= lastdigit == 0;
+      lastdigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vmzeros) {
+      while (vm % 10 == 0) {
+	vrzeros &= lastdigit == 0;
+	lastdigit = vr % 10;
+	vr /= 10;
+	vp /= 10;
+	vm /= 10;
+	removed++;
+      }
+    }
+    if (vrzeros && lastdigit == 5 && vr % 2 == 0)
+      lastdigit = 4;		// round half to even
+    *digits = vr + ((vr == vm && (!accept || !vmzeros)) || lastdigit >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      lastdigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    *digits = vr + (vr == vm || lastdigit >= 5);
+  }
+  *e10 += removed;
+}
+
+/*
+  Format 'f' into 'buf' with the fewest digits that read back to the
+  same float. There is always a decimal point, so a fortran E or F
+  edit descriptor reads the number correctly whatever its width.
+  Values from 1e-3 up to 1e9 are written in fixed notation, others
+  as d.ddddE+xx. At most 15 characters are written; returns the length.
+*/
+int format_float (float f, char *buf)
+{
+  union { float f; uint32_t u; } bits;
+  uint32_t mantissa, exponent, digits;
+  char d[10], *p = buf;
+  int e10, n, exp, i;
+
+  bits.f = f;
+  mantissa = bits.u & ((1u << FLOAT_MANTISSA_BITS) - 1);
+  exponent = (bits.u >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+
+  if (exponent == 255) {
+    strcpy (buf, mantissa ? "NaN" : (bits.u >> 31) ? "-Inf" : "Inf");
+    return strlen(buf);
+  }
+  if (bits.u >> 31)
+    *p++ = '-';
+  if (exponent == 0 && mantissa == 0) {
+    strcpy (p, "0.0");
+    return p - buf + 3;
+  }
+
+  f2d (mantissa, exponent, &digits, &e10);
+  for (n = 0; digits; n++) {	// digits in reverse order
+    d[n] = '0' + digits % 10;
+    digits /= 10;
+  }
+  exp = e10 + n - 1;		// exponent in scientific notation
+
+  if (exp >= 0 && exp < 9) {
+    for (i = 0; i <= exp; i++)
+      *p++ = i < n ? d[n-1-i] : '0';
+    *p++ = '.';
+    if (n <= exp + 1)
+      *p++ = '0';
+    for (; i < n; i++)
+      *p++ = d[n-1-i];
+  } else if (exp < 0 && exp >= -3) {
+    *p++ = '0';
+    *p++ = '.';
+    for (i = -1; i > exp; i--)
+      *p++ = '0';
+    for (i = n-1; i >= 0; i--)
+      *p++ = d[i];
+  } else {
+    *p++ = d[n-1];
+    *p++ = '.';
+    if (n == 1)
+      *p++ = '0';
+    for (i = n-2; i >= 0; i--)
+      *p++ = d[i];
+    p += sprintf (p, "E%c%02d", exp < 0 ? '-' : '+', exp < 0 ? -exp : exp);
+  }
+  *p = '\0';
+  return p - buf;
+}
+
+/*
+  Write the header line of a formatted datablock. The name is
+  written in upper case, as O does.
+*/
+int write_param_f (FILE *fp, char *par, char partyp, int64_t size, char *fmt)
+{
+  char name[26];
+  register int i;
+
+  for (i=0; i<25 && par[i]; i++)
+    name[i] = toupper(par[i]);
+  name[i] = '\0';
+  if (fprintf (fp, "%-25s %c %10" PRId64 " %s\n", name, partyp, size, fmt) < 0)
+    return 1;
+  return 0;
+}
+
+/*
+  Write 'size' integers, INT4_PER_LINE to a line, in the format
+  given by INT4_FORMAT.
+*/
+int write_int4_f (FILE *fp, int *array, int64_t size)
+{
+  register int64_t i;
+  char line[INT4_PER_LINE*12+2], *p = line;
+
+  for (i=0; i<size; i++) {
+    p += sprintf (p, " %11d", array[i]);
+    if ((i+1) % INT4_PER_LINE == 0 || i == size-1) {
+      *p++ = '\n';
+      if (fwrite (line, 1, p-line, fp) != (size_t)(p-line))
+	return 1;
+      p = line;
+    }
+  }
+  return 0;
+}
+
+/*
+  Write 'size' floats, FLOAT4_PER_LINE to a line. Each number is
+  right-justified in a field of 15 characters, and formatted with the
+  shortest representation that reads back to the same value. That
+  always has a decimal point, so a Fortran READ with FLOAT4_FORMAT
+  accepts it, in fixed or exponent form.
+*/
+int write_float4_f (FILE *fp, float *array, int64_t size)
+{
+  register int64_t i;
+  char line[FLOAT4_PER_LINE*16+2], buf[16], *p = line;
+  int n;
+
+  for (i=0; i<size; i++) {
+    n = format_float (array[i], buf);
+    memset (p, ' ', 16-n);
+    memcpy (p+16-n, buf, n);
+    p += 16;
+    if ((i+1) % FLOAT4_PER_LINE == 0 || i == size-1) {
+      *p++ = '\n';
+      if (fwrite (line, 1, p-line, fp) != (size_t)(p-line))
+	return 1;
+      p = line;
+    }
+  }
+  return 0;
+}
+
+/*
+  Write 'size' C6 variables, C6_PER_LINE to a line, in the format
+  given by C6_FORMAT.
+*/
+int write_c6_f (FILE *fp, char *array, int64_t size)
+{
+  register int64_t i;
+  char line[C6_PER_LINE*7+2], *p = line;
+
+  for (i=0; i<size; i++) {
+    *p++ = ' ';
+    memcpy (p, array+6*i, 6);
+    p += 6;
+    if ((i+1) % C6_PER_LINE == 0 || i == size-1) {
+      *p++ = '\n';
+      if (fwrite (line, 1, p-line, fp) != (size_t)(p-line))
+	return 1;
+      p = line;
+    }
+  }
+  return 0;
+}
+
+/*
+  Write 'nrec' text records of length 'size', one to a line.
+*/
+int write_text_f (FILE *fp, char *array, int64_t nrec, int size)
+{
+  register int64_t i;
+
+  for (i=0; i<nrec; i++) {
+    if (fwrite (array+i*size, 1, size, fp) != (size_t)size)
+      return 1;
+    if (fputc ('\n', fp) == EOF)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+  Local Variables:
+  mode: c
+  mode: font-lock
+  End:
+*/
@@ -9,8 +9,17 @@
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include <arrayobject.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "odb_io.h"
 
+#if PY_VERSION_HEX < 0x030d0000
+#define Py_IsFinalizing _Py_IsFinalizing
+#endif
+
+static PyObject *ErrorObject;
+
 /*
   binfil -- return 1 if fnam is a binary O file, else 0. An O binary
   file normally has the byte pattern [0 0 0 036 .] in the first 5
@@ -35,22 +44,337 @@ static int binfil(char *fnam)
    return 0;
 }
 
+/*
+  Return 1 if datablock 'par' holds the coordinates of a molecule.
+*/
+static int is_xyz (char *par, int64_t siz)
+{
+  int n = strlen(par);
+
+  return siz % 3 == 0 && n > 9 && strcmp(par+n-9, "_atom_xyz") == 0;
+}
+
+/*
+  numpy is imported the first time it is needed, so that programs
+  that only read a few datablocks do not pay for importing it.
+*/
+static int need_numpy (void)
+{
+  static int imported = 0;
+
+  if (!imported) {
+    if (_import_array() < 0)
+      return -1;
+    imported = 1;
+  }
+  return 0;
+}
+
+/*
+  Array objects. When numpy is not wanted, integer and real
+  datablocks are returned as odbparser.Array objects. They are
+  sequences, and they export their data through the buffer protocol,
+  so numpy.asarray() or memoryview() can use them without copying.
+*/
+
+typedef struct {
+  PyObject_HEAD
+  char typ;			/* 'I' or 'R' */
+  Py_ssize_t size;		/* number of elements */
+  Py_ssize_t itemsize;
+  void *data;
+} ArrayObject;
+
+static PyTypeObject ArrayType;
+
+/*
+  Create an Array of 'siz' elements. The Array takes over 'data',
+  which must have been allocated with malloc or calloc.
+*/
+static PyObject *Array_New (char typ, Py_ssize_t siz, void *data)
+{
+  ArrayObject *self;
+
+  self = PyObject_New(ArrayObject, &ArrayType);
+  if (!self)
+    return NULL;
+  self->typ = typ;
+  self->size = siz;
+  self->itemsize = 4;
+  self->data = data;
+  return (PyObject *)self;
+}
+
+static void Array_dealloc (ArrayObject *self)
+{
+  free (self->data);
+  PyObject_Del(self);
+}
+
+static Py_ssize_t Array_length (ArrayObject *self)
+{
+  return self->size;
+}
+
+static PyObject *Array_item (ArrayObject *self, Py_ssize_t i)
+{
+  if (i < 0 || i >= self->size) {
+    PyErr_SetString(PyExc_IndexError, "index out of range");
+    return NULL;
+  }
+  if (self->typ == 'I')
+    return PyLong_FromLong(((int *)self->data)[i]);
+  return PyFloat_FromDouble(((float *)self->data)[i]);
+}
+
+static int Array_getbuffer (ArrayObject *self, Py_buffer *view, int flags)
+{
+  if (PyBuffer_FillInfo(view, (PyObject *)self, self->data,
+			self->size*self->itemsize, 0, flags) < 0)
+    return -1;
+  // A consumer that does not ask for the format gets unsigned bytes,
+  // as PyBuffer_FillInfo set them up
+  if (flags & PyBUF_FORMAT) {
+    view->format = self->typ == 'I' ? "i" : "f";
+    view->itemsize = self->itemsize;
+    if (flags & PyBUF_ND)
+      view->shape = &self->size;
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+      view->strides = &self->itemsize;
+  }
+  return 0;
+}
+
+static PyObject *Array_repr (ArrayObject *self)
+{
+  return PyUnicode_FromFormat("<odbparser.Array type %c, %zd elements>",
+			      self->typ, self->size);
+}
+
+static PyObject *Array_gettypecode (ArrayObject *self, void *closure)
+{
+  return PyUnicode_FromStringAndSize(self->typ == 'I' ? "i" : "f", 1);
+}
+
+static PySequenceMethods Array_as_sequence = {
+  (lenfunc)Array_length,
+  NULL,
+  NULL,
+  (ssizeargfunc)Array_item,
+};
+
+static PyBufferProcs Array_as_buffer = {
+  (getbufferproc)Array_getbuffer,
+  NULL,
+};
+
+static PyGetSetDef Array_getset[] = {
+  {"typecode", (getter)Array_gettypecode, NULL, "struct format of the elements", NULL},
+  {NULL, NULL, NULL, NULL, NULL} /* sentinel */
+};
+
+static char Array__doc__[] =
+"Integer or real O datablock, supporting the buffer protocol";
+
+static PyTypeObject ArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "odbparser.Array",
+  .tp_basicsize = sizeof(ArrayObject),
+  .tp_dealloc = (destructor)Array_dealloc,
+  .tp_repr = (reprfunc)Array_repr,
+  .tp_as_sequence = &Array_as_sequence,
+  .tp_as_buffer = &Array_as_buffer,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = Array__doc__,
+  .tp_getset = Array_getset,
+};
+
+/*
+  Return a numpy array, or an Array if 'usenumpy' is zero, holding
+  'siz' integers or reals in 'data'.
+*/
+static PyObject *new_vector (char typ, int64_t siz, void *data, int usenumpy)
+{
+  npy_intp dims[] = {0};
+
+  if (!usenumpy)
+    return Array_New(typ, siz, data);
+  dims[0] = siz;
+  return PyArray_SimpleNewFromData(1, dims, typ == 'I' ? NPY_INT : NPY_FLOAT, data);
+}
+
+/*
+  Allocate a numpy array, or an Array if 'usenumpy' is zero, of 'siz'
+  integers or reals. The address of the data is returned in 'data'.
+*/
+static PyObject *alloc_vector (char typ, int64_t siz, int usenumpy, void **data)
+{
+  npy_intp dims[] = {0};
+  PyObject *obj;
+
+  if (!usenumpy) {
+    *data = malloc(siz > 0 ? 4*siz : 4);
+    if (!*data)
+      return PyErr_NoMemory();
+    obj = Array_New(typ, siz, *data);
+    if (!obj)
+      free(*data);
+    return obj;
+  }
+  dims[0] = siz;
+  obj = PyArray_SimpleNew(1, dims, typ == 'I' ? NPY_INT : NPY_FLOAT);
+  if (obj)
+    *data = PyArray_DATA((PyArrayObject *)obj);
+  return obj;
+}
+
+/*
+  Convert 'siz' O character variables of length 6 into a tuple of
+  byte strings. Trailing spaces are stripped.
+*/
+static PyObject *c6_tuple (char *s, Py_ssize_t siz)
+{
+  register Py_ssize_t i;
+  char buf[7], *ch;
+  PyObject *pytup, *pystr;
+
+  buf[6] = 0;
+  pytup = PyTuple_New (siz);
+  for (i=0; i < siz; i++) {
+    memcpy(buf, &s[6*i], 6);
+
+    /* strip spaces off end */
+    ch = &buf[6];
+    while (*ch <= 32 && ch > buf)
+      *ch-- = '\0';
+    /*
+       In principle we should use:
+       pystr = PyBytes_FromString(buf);
+       but it appears there are non-ascii bytes in some of
+       the character blocks in the distributed O data files.
+    */
+    pystr = PyBytes_FromString(buf);
+    if (PyTuple_SetItem (pytup, i, pystr) != 0)
+      fprintf (stderr, "tuple insert error");
+  }
+  return pytup;
+}
+
+/*
+  Split a binary text datablock of 'siz' bytes into its records,
+  which are terminated by carriage returns. Return a tuple of
+  strings with trailing spaces stripped.
+*/
+static PyObject *text_tuple (char *s, Py_ssize_t siz)
+{
+  register Py_ssize_t i,j;
+  char *ch, *t;
+  Py_ssize_t nrec=0;
+  PyObject *pytup, *pystr;
+
+  t = calloc(siz+1,sizeof(char)); // get a string that's big enough
+
+  for (i=0; i<siz; i++) { // count the number of records
+    if (s[i] == '\r')
+      nrec++;
+  }
+  pytup = PyTuple_New (nrec);
+
+  nrec = 0;
+  for (i=0,j=0; i<siz; i++) { // extract the individual strings into 't'
+    t[j] = s[i];
+
+    if (t[j] == '\r') {
+      ch = &t[j];
+      while (*ch <= 32 && ch > t) // strip spaces off end
+	*ch-- = '\0';
+
+      pystr = PyUnicode_FromString(t); // create python string
+      //pystr = PyBytes_FromString(t); // create python string
+      if (PyTuple_SetItem (pytup, nrec++, pystr) != 0) // add it to the tuple
+	fprintf (stderr, "tuple insert error");
+      j=0;
+    } else {
+      j++;
+    }
+  }
+  free(t);
+  return pytup;
+}
+
+/*
+  Convert 'siz' O character variables from a formatted file into a
+  tuple of strings. Trailing spaces are stripped.
+*/
+static PyObject *c6_str_tuple (char *s, Py_ssize_t siz)
+{
+  register Py_ssize_t i;
+  char buf[7], *ch;
+  PyObject *pytup, *pystr;
+
+  buf[6] = 0;
+  pytup = PyTuple_New (siz);
+  for (i=0; i < siz; i++) {
+    memcpy(buf, &s[6*i], 6);
+
+    /* strip spaces off end */
+    ch = &buf[6];
+    while (*ch <= 32 && ch > buf)
+      *ch-- = '\0';
+
+    pystr = PyUnicode_FromString(buf);
+    if (PyTuple_SetItem (pytup, i, pystr) != 0)
+      fprintf (stderr, "tuple insert error");
+  }
+  return pytup;
+}
+
+/*
+  Convert 'nrec' text records of length 'reclen' from a formatted
+  file into a tuple of strings. Trailing spaces are stripped.
+*/
+static PyObject *record_tuple (char *s, Py_ssize_t nrec, int reclen)
+{
+  register Py_ssize_t i,j;
+  char *ch, *t;
+  PyObject *pytup, *pystr;
+
+  t = calloc(reclen+1,sizeof(char)); // get a string that's big enough
+  pytup = PyTuple_New (nrec);
+
+  for (i=0, j=0; i<nrec; i++) { // extract the individual strings into 't'
+    memcpy (t, s+j, reclen);
+    ch = &t[reclen-1];
+    while (*ch <= 32 && ch > t) // strip spaces off end
+      *ch-- = '\0';
+    pystr = PyUnicode_FromString(t); // create python string
+    if (PyTuple_SetItem (pytup, i, pystr) != 0) // add it to the tuple
+      fprintf (stderr, "tuple insert error");
+    j += reclen;
+  }
+  free(t);
+  return pytup;
+}
+
 /*
   Read a binary O database. The data is returned in a Python
   dictionary, with datablock names as keys. Real and integer data are
   stored in numpy arrays.  Type 'C' datablocks are in O character
   strings of length 6. These are returned as a tuple of strings. Type
   'T' datavblocks are returned as a tuple of strings.  Trailing spaces
-  are stripped from both type 'C' and 'T' datablocks.
+  are stripped from both type 'C' and 'T' datablocks. If 'mat' is
+  given, it is applied to all atomic coordinates as they are decoded.
+  If 'usenumpy' is zero, Array objects are used instead of numpy
+  arrays.
  */
-static PyObject *readbinary (char *fnam)
+static PyObject *readbinary (char *fnam, const float *mat, int usenumpy)
 {
   int fd;
   char par[26], typ, *s;
-  int errcod, siz;
-  npy_intp dims[] = {0};
+  int errcod;
+  int64_t siz;
   void *vector, *data;
-  PyObject *pydict, *pykey, *pytup, *pystr;
+  PyObject *pydict, *pykey, *pytup;
 
   fd = open(fnam, O_RDONLY);
   if (fd < 0) {
@@ -79,8 +403,7 @@ static PyObject *readbinary (char *fnam)
     case 'I':
       data = calloc(siz, sizeof(int));
       read_int4 (fd, data, siz, DOSWAP);
-      dims[0] = siz;
-      vector = (void *)PyArray_SimpleNewFromData(1, dims, NPY_INT, data);
+      vector = new_vector(typ, siz, data, usenumpy);
       if (!vector) {
 	close(fd);
 	PyErr_SetString(PyExc_RuntimeError, "Failed to create integer array");
@@ -92,9 +415,11 @@ static PyObject *readbinary (char *fnam)
 
     case 'R':
       data = calloc(siz, sizeof(float));
-      read_float4 (fd, data, siz, DOSWAP);
-      dims[0] = siz;
-      vector = (void *)PyArray_SimpleNewFromData(1, dims, NPY_FLOAT, data);
+      if (mat && is_xyz(par, siz))
+	read_xyz (fd, data, siz, DOSWAP, mat);
+      else
+	read_float4 (fd, data, siz, DOSWAP);
+      vector = new_vector(typ, siz, data, usenumpy);
       if (!vector) {
 	close(fd);
 	PyErr_SetString(PyExc_RuntimeError, "Failed to create real array");
@@ -105,74 +430,19 @@ static PyObject *readbinary (char *fnam)
       break;
 
     case 'C':
-      {
-	register int i;
-	char buf[7], *ch;
-	buf[6] = 0;
-	s = calloc (siz,6*sizeof(char));
-	read_c6 (fd, s, siz, DOSWAP);
-	pytup = PyTuple_New (siz);
-	for (i=0; i < siz; i++) {
-	  memcpy(buf, &s[6*i], 6);
-
-	  /* strip spaces off end */
-	  ch = &buf[6];
-	  while (*ch <= 32 && ch > buf)
-	    *ch-- = '\0';
-	  /*
-	     In principle we should use:
-	     pystr = PyBytes_FromString(buf);
-	     but it appears there are non-ascii bytes in some of
-	     the character blocks in the distributed O data files.
-	  */
-	  pystr = PyBytes_FromString(buf);
-	  if (PyTuple_SetItem (pytup, i, pystr) != 0)
-	    fprintf (stderr, "tuple insert error");
-	}
-	free(s);
-	PyDict_SetItem (pydict, pykey, pytup); // add to dictionary
-      }
+      s = calloc (siz,6*sizeof(char));
+      read_c6 (fd, s, siz, DOSWAP);
+      pytup = c6_tuple (s, siz);
+      free(s);
+      PyDict_SetItem (pydict, pykey, pytup); // add to dictionary
       break;
 
     case 'T':
-      {
-	register int i,j;
-	char *ch, *t;
-	int nrec=0;
-
-	s = calloc(siz,sizeof(char));
-	t = calloc(siz,sizeof(char)); // get a string that's big enough
-	read_text (fd, s, siz, DOSWAP);
-
-	for (i=0; i<siz; i++) { // count the number of records
-	  if (s[i] == '\r')
-	    nrec++;
-	}
-	pytup = PyTuple_New (nrec);
-
-	nrec = 0;
-	for (i=0,j=0; i<siz; i++) { // extract the individual strings into 't'
-	  t[j] = s[i];
-
-	  if (t[j] == '\r') {
-	    ch = &t[j];
-	    while (*ch <= 32 && ch > t) // strip spaces off end
-	      *ch-- = '\0';
-
-	    pystr = PyUnicode_FromString(t); // create python string
-	    //pystr = PyBytes_FromString(t); // create python string
-	    if (PyTuple_SetItem (pytup, nrec++, pystr) != 0) // add it to the tuple
-	      fprintf (stderr, "tuple insert error");
-	    j=0;
-	  } else {
-	    j++;
-	  }
-	}
-	free(t);
-	free(s);
-	PyDict_SetItem (pydict, pykey, pytup); // add tuple to dictionary
-      }
-
+      s = calloc(siz,sizeof(char));
+      read_text (fd, s, siz, DOSWAP);
+      pytup = text_tuple (s, siz);
+      free(s);
+      PyDict_SetItem (pydict, pykey, pytup); // add tuple to dictionary
       break;
 
     } // end switch (typ)
@@ -190,14 +460,14 @@ static PyObject *readbinary (char *fnam)
    FORMAT statement. It would require a lot of programming to deal
    with this issue, and it is frankly not important enough.
 */
-static PyObject *readformatted (char *fnam)
+static PyObject *readformatted (char *fnam, const float *mat, int usenumpy)
 {
   FILE *fp;
   char par[26], typ, fmt[64];
-  int errcod, siz;
-  npy_intp dims[] = {0};
+  int errcod;
+  int64_t siz;
   void *vector, *data;
-  PyObject *pydict, *pykey, *pytup, *pystr;
+  PyObject *pydict, *pykey, *pytup;
 
   fp = fopen(fnam, "r");
   if (!fp) {
@@ -211,13 +481,13 @@ static PyObject *readformatted (char *fnam)
 
     pykey = PyUnicode_FromString(par);
 
-    switch (toupper(typ)) {
+    typ = toupper(typ);
+    switch (typ) {
 
     case 'I':
       data = calloc(siz, sizeof(int));
       read_int4_f (fp, data, siz);
-      dims[0] = siz;
-      vector = (void *)PyArray_SimpleNewFromData(1, dims, NPY_INT, data);
+      vector = new_vector(typ, siz, data, usenumpy);
       if (!vector) {
 	fclose(fp);
 	PyErr_SetString(PyExc_RuntimeError, "Failed to create integer array");
@@ -231,8 +501,9 @@ static PyObject *readformatted (char *fnam)
     case 'R':
       data = calloc(siz, sizeof(float));
       read_float4_f (fp, data, siz);
-      dims[0] = siz;
-      vector = (void *)PyArray_SimpleNewFromData(1, dims, NPY_FLOAT, data);
+      if (mat && is_xyz(par, siz))
+	xyz_transform (data, siz/3, mat, 0);
+      vector = new_vector(typ, siz, data, usenumpy);
       if (!vector) {
 	fclose(fp);
 	PyErr_SetString(PyExc_RuntimeError, "Failed to create real array");
@@ -245,24 +516,10 @@ static PyObject *readformatted (char *fnam)
 
     case 'C':
       {
-	register int i;
-	char buf[7], *ch, *s;
-	buf[6] = 0;
+	char *s;
 	s = calloc (siz,6*sizeof(char));
 	read_c6_f (fp, s, siz, fmt);
-	pytup = PyTuple_New (siz);
-	for (i=0; i < siz; i++) {
-	  memcpy(buf, &s[6*i], 6);
-
-	  /* strip spaces off end */
-	  ch = &buf[6];
-	  while (*ch <= 32 && ch > buf)
-	    *ch-- = '\0';
-
-	  pystr = PyUnicode_FromString(buf);
-	  if (PyTuple_SetItem (pytup, i, pystr) != 0)
-	    fprintf (stderr, "tuple insert error");
-	}
+	pytup = c6_str_tuple (s, siz);
 	free(s);
 	PyDict_SetItem (pydict, pykey, pytup); // add to dictionary
       }
@@ -270,29 +527,13 @@ static PyObject *readformatted (char *fnam)
 
     case 'T':
       {
-	register int i,j;
-	char *ch, *s, *t;
-	int nrec, reclen;
+	char *s;
+	int reclen;
 
 	reclen = strtol(fmt, NULL, 10);
-	nrec = siz;
-	s = calloc(nrec*reclen,sizeof(char));
-	t = calloc(reclen,sizeof(char)); // get a string that's big enough
-	read_text_f (fp, s, nrec, reclen);
-
-	pytup = PyTuple_New (nrec);
-
-	for (i=0, j=0; i<nrec; i++) { // extract the individual strings into 't'
-	  memcpy (t, s+j, reclen);
-	  ch = &t[reclen-1];
-	  while (*ch <= 32 && ch > t) // strip spaces off end
-	    *ch-- = '\0';
-	  pystr = PyUnicode_FromString(t); // create python string
-	  if (PyTuple_SetItem (pytup, i, pystr) != 0) // add it to the tuple
-	    fprintf (stderr, "tuple insert error");
-	  j += reclen;
-	}
-	free(t);
+	s = calloc(siz*reclen,sizeof(char));
+	read_text_f (fp, s, siz, reclen);
+	pytup = record_tuple (s, siz, reclen);
 	free(s);
 	PyDict_SetItem (pydict, pykey, pytup); // add tuple to dictionary
       }
@@ -306,76 +547,1994 @@ static PyObject *readformatted (char *fnam)
 }
 
 
-/* 1. Functions available in odbparser module */
+/*
+  Free a shared memory segment when the last array using it is gone.
+*/
+static void shm_capsule_destructor (PyObject *capsule)
+{
+  shm_detach (PyCapsule_GetPointer(capsule, "odbparser.shm"));
+}
 
-static PyObject *get (PyObject *self, PyObject *args)
+/*
+  Convert a decoded image into a dictionary of datablocks. Integer and
+  real datablocks become numpy arrays using the memory of the image,
+  which 'capsule' releases when the last of them is freed. They are
+  read-only unless 'writeable' is set. If 'usenumpy' is zero, they are
+  copied to Array objects instead. Character and text datablocks are
+  converted to tuples of strings as usual.
+*/
+static PyObject *image_dict (odb_shm_header *hdr, PyObject *capsule, int usenumpy,
+			     int writeable)
 {
-  char *fnam;
-  PyObject *pydict;
+  odb_shm_block *b;
+  char *data;
+  void *copy;
+  int i;
+  npy_intp dims[] = {0};
+  PyObject *pydict, *obj;
 
-  if (!PyArg_ParseTuple(args, "s" , &fnam ))
-    return NULL;
+  pydict = PyDict_New();
+  b = (odb_shm_block *)(hdr + 1);
+  for (i=0; pydict && i < hdr->nblocks; i++, b++) {
+    data = (char *)hdr + b->offset;
+    switch (b->typ) {
+    case 'I':
+    case 'R':
+      if (!usenumpy) {
+	obj = alloc_vector(b->typ, b->size, 0, &copy);
+	if (obj)
+	  memcpy (copy, data, b->nbytes);
+	break;
+      }
+      dims[0] = b->size;
+      obj = PyArray_New(&PyArray_Type, 1, dims, b->typ == 'I' ? NPY_INT : NPY_FLOAT,
+			NULL, data, 0, writeable ? NPY_ARRAY_CARRAY : NPY_ARRAY_CARRAY_RO,
+			NULL);
+      if (obj) {
+	Py_INCREF(capsule);
+	if (PyArray_SetBaseObject((PyArrayObject *)obj, capsule) < 0)
+	  Py_CLEAR(obj);
+      }
+      break;
+    case 'C':
+      obj = hdr->binary ? c6_tuple(data, b->size) : c6_str_tuple(data, b->size);
+      break;
+    case 'T':
+      obj = b->reclen ? record_tuple(data, b->size, b->reclen) :
+	text_tuple(data, b->size);
+      break;
+    default:
+      continue;
+    }
+    if (!obj || PyDict_SetItemString(pydict, b->name, obj) < 0)
+      Py_CLEAR(pydict);
+    Py_XDECREF(obj);
+  }
+  return pydict;
+}
 
-  /* Do the actual reading. The two subroutines readbinary and readformatted
-     both return a Python dictionary. */
+/*
+  Read an O file through the shared memory cache. Integer and real
+  datablocks are returned as read-only numpy arrays using the shared
+  memory; the segment is unmapped when the last of them is freed.
+  Returns NULL without an exception set if the cache cannot be used.
+*/
+static PyObject *readshared (char *fnam, int binary)
+{
+  odb_shm_header *hdr;
+  PyObject *pydict, *capsule;
 
-  if (binfil(fnam)) {
-    //fprintf (stderr, "Reading binary O file\n");
-    pydict = readbinary(fnam);
-  }  else {
-    //fprintf (stderr, "Reading formatted O file\n");
-    pydict = readformatted(fnam);
+  Py_BEGIN_ALLOW_THREADS
+  hdr = shm_attach(fnam, binary);
+  Py_END_ALLOW_THREADS
+  if (!hdr)
+    return NULL;
+  capsule = PyCapsule_New(hdr, "odbparser.shm", shm_capsule_destructor);
+  if (!capsule) {
+    shm_detach(hdr);
+    return NULL;
   }
+  pydict = image_dict(hdr, capsule, 1, 0);
+  Py_DECREF(capsule);
   return pydict;
 }
 
+/*
+  Background reading for aget(). A thread of the pool decodes the file
+  into an image without holding the GIL. The thread then hands the
+  job back to the event loop with call_soon_threadsafe(), and the
+  image is converted to a dictionary in the loop thread, where the
+  result of the future is set. When the future is cancelled, the
+  thread stops reading before the next datablock.
+*/
+typedef struct {
+  char *fnam;
+  int usenumpy;
+  float mat[16];
+  int usemat;
+  int shared, verify;
+  volatile int cancelled;
+  int err;			/* errno, if reading failed */
+  char msg[256];		/* why verification failed */
+  odb_shm_header *hdr;		/* the decoded file */
+  int mapped;			/* hdr is a shared memory segment */
+  PyObject *self;		/* capsule owning the job */
+  PyObject *loop, *future, *finish;
+} aget_job;
+
+static void image_capsule_destructor (PyObject *capsule)
+{
+  free (PyCapsule_GetPointer(capsule, "odbparser.image"));
+}
 
-/* 2. Doc strings */
+static void aget_job_destructor (PyObject *capsule)
+{
+  aget_job *job = PyCapsule_GetPointer(capsule, "odbparser.job");
+
+  Py_XDECREF(job->loop);
+  Py_XDECREF(job->future);
+  free (job->fnam);
+  if (job->mapped)
+    shm_detach (job->hdr);
+  else
+    free (job->hdr);
+  free (job);
+}
 
-static char odbparser_module__doc__[] =
-"Parse O binary and formatted files";
+/*
+  Runs on a thread of the pool. The image is cleared first, so that a
+  datablock cut short in the file cannot leave stray bytes in it.
+*/
+static void aget_work (void *arg)
+{
+  aget_job *job = arg;
+  odb_entry *list;
+  odb_shm_block *b;
+  int i, n, binary;
+  int64_t length;
+  struct stat st, now;
+  PyGILState_STATE gil;
+  PyObject *r;
+
+  binary = binfil(job->fnam) != 0;
+  if (!job->cancelled) {
+    if (job->verify) {
+      if (!binary)
+	snprintf (job->msg, sizeof(job->msg), "%s: not a binary O file", job->fnam);
+      else if (verify_framing(job->fnam, &list, &n, &st, job->msg) == 0)
+	free (list);
+    }
+    if (!job->msg[0] && job->shared) {
+      job->hdr = shm_attach(job->fnam, binary);
+      job->mapped = job->hdr != NULL;
+    }
+  }
+  if (!job->cancelled && !job->msg[0] && !job->mapped) {
+    errno = 0;
+    list = image_scan(job->fnam, binary, &n, &length);
+    if (n < 0) {
+      job->err = errno ? errno : EIO;
+    } else {
+      job->hdr = calloc(1, length);
+      if (!job->hdr)
+	job->err = ENOMEM;
+      else if (image_fill(job->hdr, length, job->fnam, binary, list, n, &job->cancelled))
+	job->err = EIO;
+      else if (job->usemat) {
+	b = (odb_shm_block *)(job->hdr + 1);
+	for (i=0; i<n; i++, b++)
+	  if (b->typ == 'R' && is_xyz(b->name, b->size))
+	    xyz_transform ((float *)((char *)job->hdr + b->offset), b->size/3, job->mat, 0);
+      }
+      free (list);
+    }
+  }
+  // what was decoded must be the file that was checked
+  if (job->verify && !job->cancelled && !job->msg[0] && !job->err &&
+      (stat(job->fnam, &now) < 0 || !same_file(&st, &now)))
+    snprintf (job->msg, sizeof(job->msg), "%s: file changed while it was read", job->fnam);
+
+  // the interpreter is going away, and the job with it
+  if (Py_IsFinalizing())
+    return;
+  gil = PyGILState_Ensure();
+  r = PyObject_CallMethod(job->loop, "call_soon_threadsafe", "O", job->finish);
+  if (!r) {
+    // the loop has been closed, nobody is waiting for the result
+    PyErr_Clear();
+    Py_CLEAR(job->finish);
+    Py_CLEAR(job->future);
+    Py_CLEAR(job->loop);
+  }
+  Py_XDECREF(r);
+  Py_DECREF(job->self);		// the reference held by the thread
+  PyGILState_Release(gil);
+}
 
-static char odbparser_get__doc__[] =
-"get(filename) -- return dictionary of O datablocks";
+/*
+  Called in the loop thread when the thread has finished.
+*/
+static PyObject *aget_finish (PyObject *capsule, PyObject *unused)
+{
+  aget_job *job = PyCapsule_GetPointer(capsule, "odbparser.job");
+  PyObject *r, *pydict, *image, *type, *value, *tb;
+
+  r = PyObject_CallMethod(job->future, "done", NULL);
+  if (r && !PyObject_IsTrue(r)) {
+    Py_DECREF(r);
+    pydict = NULL;
+    if (job->msg[0]) {
+      PyErr_SetString(ErrorObject, job->msg);
+    } else if (job->err) {
+      errno = job->err;
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, job->fnam);
+    } else if (job->mapped) {
+      image = PyCapsule_New(job->hdr, "odbparser.shm", shm_capsule_destructor);
+      if (image) {
+	job->hdr = NULL;
+	job->mapped = 0;
+	pydict = image_dict((odb_shm_header *)PyCapsule_GetPointer(image, "odbparser.shm"),
+			    image, 1, 0);
+	Py_DECREF(image);
+      }
+    } else {
+      image = PyCapsule_New(job->hdr, "odbparser.image", image_capsule_destructor);
+      if (image) {
+	job->hdr = NULL;
+	pydict = image_dict((odb_shm_header *)PyCapsule_GetPointer(image, "odbparser.image"),
+			    image, job->usenumpy, 1);
+	Py_DECREF(image);
+      }
+    }
+    if (pydict) {
+      r = PyObject_CallMethod(job->future, "set_result", "O", pydict);
+      Py_DECREF(pydict);
+    } else {
+      PyErr_Fetch(&type, &value, &tb);
+      PyErr_NormalizeException(&type, &value, &tb);
+      r = PyObject_CallMethod(job->future, "set_exception", "O", value);
+      Py_XDECREF(type);
+      Py_XDECREF(value);
+      Py_XDECREF(tb);
+    }
+  }
+  Py_XDECREF(r);
 
+  Py_CLEAR(job->finish);
+  Py_CLEAR(job->future);
+  Py_CLEAR(job->loop);
+  if (PyErr_Occurred())
+    return NULL;
+  Py_RETURN_NONE;
+}
 
-/* 3. Method table mapping names to wrappers */
+/*
+  Done callback of the future. If the future is cancelled before the
+  thread has finished, the thread stops reading.
+*/
+static PyObject *aget_done (PyObject *capsule, PyObject *future)
+{
+  aget_job *job = PyCapsule_GetPointer(capsule, "odbparser.job");
 
-static PyMethodDef odbparser_methods[] = {
-  {"get", (PyCFunction)get,   METH_VARARGS, odbparser_get__doc__ },
-  {NULL, (PyCFunction)NULL, 0, NULL} /* sentinel */
-};
+  job->cancelled = 1;
+  Py_RETURN_NONE;
+}
 
+static PyMethodDef aget_finish_def = {"aget_finish", (PyCFunction)aget_finish, METH_NOARGS, NULL};
+static PyMethodDef aget_done_def = {"aget_done", (PyCFunction)aget_done, METH_O, NULL};
 
-/* 4. Module initialization function */
+/*
+  Read elements 'start' to 'stop' of datablock 'name' from a binary O
+  file. The data record is located by skipping the records before it,
+  and only the bytes of the slice are read and byte swapped. For
+  coordinate datablocks an element is one atom, or three reals.
+  Slicing a type 'T' datablock needs the whole record, since the text
+  records are of varying length.
+*/
+static PyObject *slice_binary (char *fnam, char *name, Py_ssize_t start,
+			       Py_ssize_t stop, int usenumpy)
+{
+  int fd;
+  char typ, *buf;
+  int64_t siz, nbytes, per = 1, n, w, got = -1;
+  off_t offset;
+  void *data = NULL;
+  PyObject *obj, *pytup;
 
-static struct PyModuleDef moduledef = {
-  PyModuleDef_HEAD_INIT,
-  "odbparser",             /* name of module */
-  odbparser_module__doc__, /* module documentation */
-  -1,                      /* m_size */
-  odbparser_methods,       /* methods */
-  NULL,                    /* m_reload */
-  NULL,                    /* m_traverse */
-  NULL,                    /* m_clear */
-  NULL                     /* m_free */
-};
+  fd = open(fnam, O_RDONLY);
+  if (fd < 0)
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, fnam);
+  offset = find_param (fd, name, &typ, &siz, DOSWAP);
+  if (offset < 0) {
+    close(fd);
+    PyErr_SetString(PyExc_KeyError, name);
+    return NULL;
+  }
 
+  if (typ == 'T') {
+    lseek (fd, offset, SEEK_SET);
+    buf = read_record (fd, &nbytes, DOSWAP);
+    close(fd);
+    if (!buf) {
+      PyErr_SetString(PyExc_IOError, "error reading datablock");
+      return NULL;
+    }
+    pytup = text_tuple (buf, nbytes);
+    free(buf);
+    obj = PySequence_GetSlice (pytup, start, stop);
+    Py_DECREF(pytup);
+    return obj;
+  }
+  if (typ != 'I' && typ != 'R' && typ != 'C') {
+    close(fd);
+    PyErr_Format(PyExc_ValueError, "unknown datablock type '%c'", typ);
+    return NULL;
+  }
 
-static PyObject *ErrorObject;
+  if (typ == 'R' && is_xyz(name, siz))
+    per = 3;
+  n = PySlice_AdjustIndices (siz/per, &start, &stop, 1)*per;
+  w = typ == 'C' ? 6 : 4;
+
+  if (typ == 'C') {
+    obj = NULL;
+    data = buf = malloc(n > 0 ? w*n : 1);
+    if (!buf) {
+      close(fd);
+      return PyErr_NoMemory();
+    }
+  } else {
+    obj = alloc_vector(typ, n, usenumpy, &data);
+    if (!obj) {
+      close(fd);
+      return NULL;
+    }
+  }
 
-PyMODINIT_FUNC PyInit_odbparser(void) {
-  PyObject *m, *d;
+  Py_BEGIN_ALLOW_THREADS
+  got = pread_record (fd, offset, data, w*per*start, w*n, DOSWAP);
+  if (got == w*n && w == 4 && DOSWAP)
+    swap4 (data, n);
+  Py_END_ALLOW_THREADS
+  close(fd);
 
-  /* Create the module and add the functions */
-  m = PyModule_Create(&moduledef);
+  if (got != w*n) {
+    if (typ == 'C')
+      free(data);
+    Py_XDECREF(obj);
+    PyErr_SetString(PyExc_IOError, "error reading datablock");
+    return NULL;
+  }
+  if (typ == 'C') {
+    obj = c6_tuple (data, n);
+    free(data);
+  }
+  return obj;
+}
 
-  /* Add some symbolic constants to the module */
-  d = PyModule_GetDict(m);
-  ErrorObject = PyUnicode_FromString("odbparser.error");
-  PyDict_SetItemString(d, "error", ErrorObject);
+/*
+  Read elements 'start' to 'stop' of datablock 'name' from a formatted
+  O file. The datablocks before it, and the elements before 'start',
+  are skipped without being converted.
+*/
+static PyObject *slice_formatted (char *fnam, char *name, Py_ssize_t start,
+				  Py_ssize_t stop, int usenumpy)
+{
+  FILE *fp;
+  char typ, fmt[64], *buf;
+  int64_t siz, per = 1, n, k;
+  int reclen, perline, err = 1;
+  void *data;
+  PyObject *obj = NULL;
+
+  fp = fopen(fnam, "r");
+  if (!fp)
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, fnam);
+  if (find_param_f (fp, name, &typ, &siz, fmt)) {
+    fclose(fp);
+    PyErr_SetString(PyExc_KeyError, name);
+    return NULL;
+  }
+
+  typ = toupper(typ);
+  if (typ == 'R' && is_xyz(name, siz))
+    per = 3;
+  n = PySlice_AdjustIndices (siz/per, &start, &stop, 1)*per;
+
+  switch (typ) {
+
+  case 'I':
+  case 'R':
+    obj = alloc_vector(typ, n, usenumpy, &data);
+    if (!obj)
+      break;
+    err = skip_words_f (fp, per*start);
+    if (!err && typ == 'I')
+      err = read_int4_f (fp, data, n);
+    else if (!err)
+      err = read_float4_f (fp, data, n);
+    break;
+
+  case 'C':
+    // skip whole lines, then read from the start of the line
+    perline = c6_per_line_f (fmt);
+    if (perline == 0)
+      break;
+    k = start % perline;
+    buf = calloc (k+n > 0 ? k+n : 1, 6*sizeof(char));
+    if (!buf)
+      break;
+    err = skip_lines_f (fp, start/perline);
+    if (!err && n > 0)
+      err = read_c6_f (fp, buf, k+n, fmt);
+    if (!err)
+      obj = c6_str_tuple (buf + 6*k, n);
+    free(buf);
+    break;
+
+  case 'T':
+    reclen = strtol(fmt, NULL, 10);
+    buf = calloc (n > 0 ? n*reclen : 1, sizeof(char));
+    if (!buf)
+      break;
+    err = skip_lines_f (fp, start);
+    if (!err && read_text_f (fp, buf, n, reclen) < n*reclen) {
+      PyErr_Format(ErrorObject, "%s: datablock %s ends early", fnam, name);
+      err = 1;
+    }
+    if (!err)
+      obj = record_tuple (buf, n, reclen);
+    free(buf);
+    break;
+  }
+  fclose(fp);
+
+  if (err) {
+    Py_XDECREF(obj);
+    if (!PyErr_Occurred())
+      PyErr_SetString(PyExc_IOError, "error reading datablock");
+    return NULL;
+  }
+  return obj;
+}
+
+/*
+  Database objects. A Database keeps the dictionary of datablocks
+  read from an O file together with the file offset, record length
+  and a hash of the payload of every datablock. The refresh() method
+  does nothing if the file has the same size and modification time
+  as when it was last read. Otherwise it rescans the headers and
+  record lengths, and decodes the datablocks whose header or length
+  has changed. The others are hashed, and decoded only if the hash
+  differs. Integer and real arrays whose size is unchanged are
+  updated in place, so references held by the caller see the new
+  values. If the file is truncated or changes while it is read,
+  nothing is updated.
+*/
+
+typedef struct {
+  char name[26];
+  char typ;
+  int64_t size;			/* number of elements */
+  off_t offset;			/* file offset of the data record */
+  int64_t nbytes;		/* length of the data record in bytes */
+  uint64_t hash;		/* hash of the data record */
+} blockinfo;
+
+typedef struct {
+  PyObject_HEAD
+  char *fnam;
+  PyObject *blocks;		/* dictionary of datablocks */
+  PyObject *index;		/* datablock name -> position in info */
+  blockinfo *info;
+  int nblocks;
+  struct stat st;		/* of the file when it was last read */
+} DatabaseObject;
 
-  import_array();
+static PyTypeObject DatabaseType;
+
+/*
+  Convert a binary data record into a Python object. The record
+  buffer is consumed.
+*/
+static PyObject *binary_block (char typ, int64_t siz, char *buf, int64_t nbytes)
+{
+  npy_intp dims[] = {0};
+  PyObject *obj = NULL;
+
+  switch (typ) {
+  case 'I':
+  case 'R':
+    dims[0] = siz;
+    obj = PyArray_SimpleNew(1, dims, typ == 'I' ? NPY_INT : NPY_FLOAT);
+    if (!obj)
+      break;
+    memset (PyArray_DATA((PyArrayObject *)obj), 0, 4*siz);
+    memcpy (PyArray_DATA((PyArrayObject *)obj), buf, nbytes < 4*siz ? nbytes : 4*siz);
+    if (DOSWAP)
+      swap4 (PyArray_DATA((PyArrayObject *)obj), siz);
+    break;
+  case 'C':
+    if (nbytes < 6*siz)
+      siz = nbytes/6;
+    obj = c6_tuple (buf, siz);
+    break;
+  case 'T':
+    obj = text_tuple (buf, nbytes);
+    break;
+  default:
+    Py_INCREF(Py_None);
+    obj = Py_None;
+  }
+  free (buf);
+  return obj;
+}
+
+/*
+  Return 1 if the existing array 'obj' can take the new contents of a
+  datablock in place.
+*/
+static int reusable (PyObject *obj, char typ, int64_t siz, int64_t nbytes)
+{
+  PyArrayObject *arr;
+
+  if ((typ != 'I' && typ != 'R') || !obj || !PyArray_Check(obj))
+    return 0;
+  arr = (PyArrayObject *)obj;
+  return PyArray_SIZE(arr) == siz && nbytes == 4*siz && PyArray_ISCARRAY(arr)
+    && PyArray_TYPE(arr) == (typ == 'I' ? NPY_INT : NPY_FLOAT);
+}
+
+static blockinfo *find_block (DatabaseObject *self, PyObject *pykey)
+{
+  PyObject *pyidx;
+
+  if (!self->index)
+    return NULL;
+  pyidx = PyDict_GetItem(self->index, pykey); // borrowed
+  return pyidx ? &self->info[PyLong_AsLong(pyidx)] : NULL;
+}
+
+/*
+  Find the datablocks of a binary file from the headers and the
+  record lengths, without reading the data. The scan must reach the
+  end of the file, or a header of size 0. Returns the number of
+  datablocks, or -1 with odbparser.error set.
+*/
+static int scan_frames (int fd, char *fnam, blockinfo **list)
+{
+  int n = 0, nalloc = 0, errcod, err = 0;
+  char par[26], typ, *s;
+  int64_t siz, len;
+  off_t offset = 0, next;
+  blockinfo *info = NULL, *b;
+
+  memset (par, 0, 26);
+  while (!err) {
+    errcod = pread_param(fd, offset, par, &typ, &siz, &next, DOSWAP);
+    if (errcod == -1 || (errcod == 0 && siz == 0))
+      break;			// a clean end of the datablocks
+    if (errcod < 0) {
+      PyErr_Format(ErrorObject, "%s: broken datablock header at offset %lld",
+		   fnam, (long long)offset);
+      err = 1;
+      break;
+    }
+
+    /* strip spaces off end of datablock name */
+    s = &par[25];
+    while (*s <= 32 && s > par)
+      *s-- = '\0';
+
+    offset = next;
+    len = frame_record(fd, offset, &next, DOSWAP);
+    if (len < 0) {
+      PyErr_Format(ErrorObject, "%s: datablock %s: data record at offset %lld "
+		   "is truncated or corrupt", fnam, par, (long long)offset);
+      err = 1;
+      break;
+    }
+
+    if (n == nalloc) {
+      nalloc = nalloc ? 2*nalloc : 64;
+      b = realloc(info, nalloc*sizeof(blockinfo));
+      if (!b) {
+	PyErr_NoMemory();
+	err = 1;
+	break;
+      }
+      info = b;
+    }
+    b = &info[n++];
+    memcpy (b->name, par, 26);
+    b->typ = typ;
+    b->size = siz;
+    b->offset = offset;
+    b->nbytes = len;
+    b->hash = 0;
+    offset = next;
+  }
+
+  if (err) {
+    free (info);
+    return -1;
+  }
+  *list = info;
+  return n;
+}
+
+/*
+  Scan a binary O file, and bring the dictionary of datablocks up to
+  date. The names of new and modified datablocks are appended to
+  'changed', and the names of all datablocks found are added to 'seen'.
+  All records needed are read before anything is changed, so that on
+  error the dictionary is left as it was.
+*/
+static int scan_binary (DatabaseObject *self, PyObject *changed, PyObject *seen,
+			struct stat *st)
+{
+  int fd, i, n, err = 0;
+  char **load = NULL;
+  blockinfo *info = NULL, *b, *old;
+  PyObject *keys = NULL, *pykey, *obj, **objs = NULL, *index = NULL, *pyidx;
+  struct stat st2;
+
+  fd = open(self->fnam, O_RDONLY);
+  if (fd < 0 || fstat(fd, st) < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->fnam);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  n = scan_frames(fd, self->fnam, &info);
+  if (n < 0) {
+    close(fd);
+    return -1;
+  }
+  keys = PyList_New(n);
+  load = calloc(n > 0 ? n : 1, sizeof(char *));
+  objs = calloc(n > 0 ? n : 1, sizeof(PyObject *));
+  if (!keys || !load || !objs) {
+    PyErr_NoMemory();
+    err = 1;
+  }
+
+  /* Read the datablocks that are new or whose contents have changed */
+  for (i=0; i<n && !err; i++) {
+    b = &info[i];
+    pykey = PyUnicode_FromString(b->name);
+    if (!pykey) {
+      err = 1;
+      break;
+    }
+    PyList_SET_ITEM(keys, i, pykey);
+    old = find_block(self, pykey);
+    obj = PyDict_GetItem(self->blocks, pykey); // borrowed
+
+    if (old && obj && old->typ == b->typ && old->size == b->size &&
+	old->nbytes == b->nbytes) {
+      // same header and length, possibly moved: compare the contents
+      Py_BEGIN_ALLOW_THREADS
+      err = hash_record(fd, b->offset, b->nbytes, DOSWAP, &b->hash);
+      Py_END_ALLOW_THREADS
+      if (err)
+	break;
+      if (b->hash == old->hash)
+	continue;
+    }
+    load[i] = malloc(b->nbytes > 0 ? b->nbytes : 1);
+    if (!load[i]) {
+      PyErr_NoMemory();
+      err = 1;
+      break;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    if (pread_record(fd, b->offset, load[i], 0, b->nbytes, DOSWAP) != b->nbytes)
+      err = 1;
+    else
+      b->hash = hash_bytes(0, load[i], b->nbytes);
+    Py_END_ALLOW_THREADS
+    if (err)
+      break;
+
+    // arrays updated in place keep their record until the end
+    if (!reusable(obj, b->typ, b->size, b->nbytes)) {
+      objs[i] = binary_block(b->typ, b->size, load[i], b->nbytes);
+      load[i] = NULL;
+      if (!objs[i]) {
+	err = 1;
+	break;
+      }
+    }
+  }
+  if (err && !PyErr_Occurred())
+    PyErr_Format(ErrorObject, "%s: error reading datablock %s", self->fnam, info[i].name);
+
+  /* A file being written by O is read again at the next refresh */
+  if (!err && (fstat(fd, &st2) < 0 || !same_file(st, &st2))) {
+    PyErr_Format(ErrorObject, "%s: file changed while it was read", self->fnam);
+    err = 1;
+  }
+  close(fd);
+
+  /* Nothing can fail now, bring the dictionary up to date */
+  index = err ? NULL : PyDict_New();
+  for (i=0; i<n && index; i++) {
+    pykey = PyList_GET_ITEM(keys, i);
+    b = &info[i];
+    if (objs[i]) {
+      PyDict_SetItem (self->blocks, pykey, objs[i]);
+      PyList_Append (changed, pykey);
+    } else if (load[i]) {
+      obj = PyDict_GetItem(self->blocks, pykey);
+      memcpy (PyArray_DATA((PyArrayObject *)obj), load[i], b->nbytes);
+      if (DOSWAP)
+	swap4 (PyArray_DATA((PyArrayObject *)obj), b->size);
+      PyList_Append (changed, pykey);
+    }
+    PySet_Add (seen, pykey);
+    pyidx = PyLong_FromLong(i);
+    PyDict_SetItem (index, pykey, pyidx);
+    Py_DECREF(pyidx);
+  }
+  if (!err && !index)
+    err = 1;
+
+  for (i=0; i<n && load && objs; i++) {
+    free (load[i]);
+    Py_XDECREF(objs[i]);
+  }
+  free (load);
+  free (objs);
+  Py_XDECREF(keys);
+  if (err) {
+    free (info);
+    return -1;
+  }
+
+  free (self->info);
+  self->info = info;
+  self->nblocks = n;
+  Py_XDECREF(self->index);
+  self->index = index;
+  return 0;
+}
+
+/*
+  Formatted files are not scanned incrementally; the whole file is
+  read again and every datablock is reported as changed.
+*/
+static int scan_formatted (DatabaseObject *self, PyObject *changed, PyObject *seen,
+			   struct stat *st)
+{
+  PyObject *pydict, *pykey, *obj;
+  Py_ssize_t pos = 0;
+
+  if (stat(self->fnam, st) < 0 || !(pydict = readformatted(self->fnam, NULL, 1))) {
+    if (!PyErr_Occurred())
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->fnam);
+    return -1;
+  }
+  while (PyDict_Next(pydict, &pos, &pykey, &obj)) {
+    PyDict_SetItem (self->blocks, pykey, obj);
+    PyList_Append (changed, pykey);
+    PySet_Add (seen, pykey);
+  }
+  Py_DECREF(pydict);
+  free (self->info);
+  self->info = NULL;
+  self->nblocks = 0;
+  Py_CLEAR(self->index);
+  return 0;
+}
+
+/*
+  Rescan the file. Returns a tuple (changed, removed) of lists of
+  datablock names.
+*/
+static PyObject *Database_refresh (DatabaseObject *self, PyObject *args)
+{
+  PyObject *changed, *removed, *pykey, *obj, *seen;
+  Py_ssize_t pos = 0;
+  int errcod;
+  struct stat st;
+  register int i;
+
+  changed = PyList_New(0);
+  removed = PyList_New(0);
+
+  /* Nothing to do if the file has not been touched */
+  if (stat(self->fnam, &st) == 0 && same_file(&st, &self->st))
+    return Py_BuildValue("(NN)", changed, removed);
+
+  seen = PySet_New(NULL);
+  if (binfil(self->fnam))
+    errcod = scan_binary(self, changed, seen, &st);
+  else
+    errcod = scan_formatted(self, changed, seen, &st);
+  if (errcod) {
+    Py_DECREF(changed);
+    Py_DECREF(removed);
+    Py_DECREF(seen);
+    return NULL;
+  }
+  self->st = st;
+
+  /* Drop datablocks that are no longer in the file */
+  while (PyDict_Next(self->blocks, &pos, &pykey, &obj)) {
+    if (!PySet_Contains(seen, pykey))
+      PyList_Append (removed, pykey);
+  }
+  Py_DECREF(seen);
+  for (i=0; i < PyList_GET_SIZE(removed); i++)
+    PyDict_DelItem (self->blocks, PyList_GET_ITEM(removed, i));
+
+  return Py_BuildValue("(NN)", changed, removed);
+}
+
+/*
+  Return a tuple (type, size, offset, nbytes, hash) describing a
+  datablock of a binary file.
+*/
+static PyObject *Database_blockinfo (DatabaseObject *self, PyObject *args)
+{
+  char *name;
+  blockinfo *b;
+  PyObject *pykey;
+
+  if (!PyArg_ParseTuple(args, "s", &name))
+    return NULL;
+  pykey = PyUnicode_FromString(name);
+  if (!pykey)
+    return NULL;
+  b = find_block(self, pykey);
+  Py_DECREF(pykey);
+  if (!b) {
+    PyErr_SetString(PyExc_KeyError, name);
+    return NULL;
+  }
+  return Py_BuildValue("(CLLLK)", b->typ, (long long)b->size, (long long)b->offset,
+		       (long long)b->nbytes, (unsigned long long)b->hash);
+}
+
+static int Database_init (DatabaseObject *self, PyObject *args, PyObject *kwds)
+{
+  char *fnam;
+  PyObject *res;
+
+  if (!PyArg_ParseTuple(args, "s", &fnam))
+    return -1;
+  if (need_numpy())
+    return -1;
+
+  free (self->fnam);
+  self->fnam = strdup(fnam);
+  free (self->info);
+  self->info = NULL;
+  self->nblocks = 0;
+  memset (&self->st, 0, sizeof(struct stat));
+  Py_CLEAR(self->index);
+  Py_XDECREF(self->blocks);
+  self->blocks = PyDict_New();
+
+  res = Database_refresh(self, NULL);
+  if (!res)
+    return -1;
+  Py_DECREF(res);
+  return 0;
+}
+
+static void Database_dealloc (DatabaseObject *self)
+{
+  free (self->fnam);
+  free (self->info);
+  Py_XDECREF(self->index);
+  Py_XDECREF(self->blocks);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static Py_ssize_t Database_length (DatabaseObject *self)
+{
+  return PyDict_Size(self->blocks);
+}
+
+static PyObject *Database_subscript (DatabaseObject *self, PyObject *key)
+{
+  PyObject *obj = PyDict_GetItemWithError(self->blocks, key);
+
+  if (!obj) {
+    if (!PyErr_Occurred())
+      PyErr_SetObject(PyExc_KeyError, key);
+    return NULL;
+  }
+  Py_INCREF(obj);
+  return obj;
+}
+
+static PyObject *Database_getfilename (DatabaseObject *self, void *closure)
+{
+  return PyUnicode_FromString(self->fnam);
+}
+
+static PyObject *Database_getblocks (DatabaseObject *self, void *closure)
+{
+  Py_INCREF(self->blocks);
+  return self->blocks;
+}
+
+static char Database__doc__[] =
+"Database(filename) -- O database that can be refreshed incrementally";
+
+static char Database_refresh__doc__[] =
+"refresh() -- reread changed datablocks, return (changed, removed)";
+
+static char Database_blockinfo__doc__[] =
+"blockinfo(name) -- return (type, size, offset, nbytes, hash) of a datablock";
+
+static PyMethodDef Database_methods[] = {
+  {"refresh", (PyCFunction)Database_refresh, METH_NOARGS, Database_refresh__doc__ },
+  {"blockinfo", (PyCFunction)Database_blockinfo, METH_VARARGS, Database_blockinfo__doc__ },
+  {NULL, (PyCFunction)NULL, 0, NULL} /* sentinel */
+};
+
+static PyGetSetDef Database_getset[] = {
+  {"filename", (getter)Database_getfilename, NULL, "name of the O file", NULL},
+  {"blocks", (getter)Database_getblocks, NULL, "dictionary of datablocks", NULL},
+  {NULL, NULL, NULL, NULL, NULL} /* sentinel */
+};
+
+static PyMappingMethods Database_as_mapping = {
+  (lenfunc)Database_length,
+  (binaryfunc)Database_subscript,
+  NULL
+};
+
+static PyTypeObject DatabaseType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "odbparser.Database",
+  .tp_basicsize = sizeof(DatabaseObject),
+  .tp_dealloc = (destructor)Database_dealloc,
+  .tp_as_mapping = &Database_as_mapping,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = Database__doc__,
+  .tp_methods = Database_methods,
+  .tp_getset = Database_getset,
+  .tp_init = (initproc)Database_init,
+  .tp_new = PyType_GenericNew,
+};
+
+
+/*
+  Write one datablock to a formatted O file. The type of the
+  datablock is taken from 'typ' if it is one of I, R, C or T, else it
+  is deduced from the value: numpy arrays and sequences of numbers
+  become type I or R, sequences of bytes become type C, and sequences
+  of strings become type T. Returns 0 on success, else -1 with a
+  Python exception set.
+*/
+static int writeblock (FILE *fp, char *par, char typ, PyObject *value)
+{
+  PyArrayObject *arr;
+  PyObject *seq, *item;
+  char *s, *buf, fmt[16];
+  Py_ssize_t i, n, len, reclen;
+  int errcod = 0;
+
+  if (strlen(par) > 25) {
+    PyErr_Format(PyExc_ValueError, "datablock name too long: %s", par);
+    return -1;
+  }
+
+  if (typ != 'I' && typ != 'R' && typ != 'C' && typ != 'T') {
+    if (PyArray_Check(value))
+      typ = PyArray_ISFLOAT((PyArrayObject *)value) ? 'R' : 'I';
+    else if (PySequence_Check(value) && PySequence_Size(value) > 0) {
+      item = PySequence_GetItem(value, 0);
+      if (!item)
+	return -1;
+      if (PyBytes_Check(item))
+	typ = 'C';
+      else if (PyUnicode_Check(item))
+	typ = 'T';
+      else
+	typ = PyFloat_Check(item) ? 'R' : 'I';
+      Py_DECREF(item);
+    } else {
+      typ = 'I';
+    }
+  }
+
+  switch (typ) {
+
+  case 'I':
+  case 'R':
+    arr = (PyArrayObject *)PyArray_FROM_OTF(value, typ == 'I' ? NPY_INT : NPY_FLOAT,
+					    NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!arr)
+      return -1;
+    n = PyArray_SIZE(arr);
+    Py_BEGIN_ALLOW_THREADS
+    if (typ == 'I')
+      errcod = write_param_f(fp, par, typ, n, INT4_FORMAT)
+	|| write_int4_f(fp, PyArray_DATA(arr), n);
+    else
+      errcod = write_param_f(fp, par, typ, n, FLOAT4_FORMAT)
+	|| write_float4_f(fp, PyArray_DATA(arr), n);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(arr);
+    break;
+
+  case 'C':
+  case 'T':
+    seq = PySequence_Fast(value, "datablock must be a sequence of strings");
+    if (!seq)
+      return -1;
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    /* Type T records are at least 72 characters long */
+    reclen = typ == 'C' ? 6 : 72;
+    for (i=0; i < n; i++) {
+      item = PySequence_Fast_GET_ITEM(seq, i);
+      if (PyBytes_Check(item))
+	len = PyBytes_GET_SIZE(item);
+      else if (PyUnicode_Check(item) && PyUnicode_IS_ASCII(item))
+	len = PyUnicode_GET_LENGTH(item);
+      else if (PyUnicode_Check(item)) {
+	PyErr_Format(PyExc_ValueError, "%s: element %zd is not an ASCII string", par, i);
+	Py_DECREF(seq);
+	return -1;
+      } else {
+	PyErr_Format(PyExc_TypeError, "%s: datablock must be a sequence of strings", par);
+	Py_DECREF(seq);
+	return -1;
+      }
+      if (typ == 'C' && len > 6) {
+	PyErr_Format(PyExc_ValueError, "%s: type C elements are at most 6 characters", par);
+	Py_DECREF(seq);
+	return -1;
+      }
+      if (len > reclen)
+	reclen = len;
+    }
+    if (reclen > 254) {
+      PyErr_Format(PyExc_ValueError, "%s: text records are at most 254 characters", par);
+      Py_DECREF(seq);
+      return -1;
+    }
+
+    buf = malloc(n*reclen+1);
+    if (!buf) {
+      Py_DECREF(seq);
+      PyErr_NoMemory();
+      return -1;
+    }
+    memset (buf, ' ', (size_t)n*reclen);
+    for (i=0; i < n; i++) {
+      item = PySequence_Fast_GET_ITEM(seq, i);
+      if (PyBytes_Check(item)) {
+	s = PyBytes_AS_STRING(item);
+	len = PyBytes_GET_SIZE(item);
+      } else {
+	// checked above to be ASCII, and to fit the record
+	s = (char *)PyUnicode_AsUTF8AndSize(item, &len);
+	if (!s) {
+	  free (buf);
+	  Py_DECREF(seq);
+	  return -1;
+	}
+      }
+      memcpy (buf+i*reclen, s, len);
+    }
+    Py_DECREF(seq);
+
+    if (typ == 'C')
+      errcod = write_param_f(fp, par, typ, n, C6_FORMAT) || write_c6_f(fp, buf, n);
+    else {
+      sprintf (fmt, "%zd", reclen);
+      errcod = write_param_f(fp, par, typ, n, fmt) || write_text_f(fp, buf, n, reclen);
+    }
+    free (buf);
+    break;
+  }
+
+  if (errcod) {
+    PyErr_SetFromErrno(PyExc_IOError);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Copy 'n' numbers from the sequence 'obj' to 'mat'.
+*/
+static int get_numbers (PyObject *obj, float *mat, Py_ssize_t n)
+{
+  PyObject *seq;
+  register Py_ssize_t i;
+
+  seq = PySequence_Fast(obj, "transformation must be a sequence");
+  if (!seq)
+    return -1;
+  if (PySequence_Fast_GET_SIZE(seq) != n) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_ValueError, "transformation must have 16 elements, or 4 rows of 4");
+    return -1;
+  }
+  for (i=0; i < n && !PyErr_Occurred(); i++)
+    mat[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+  Py_DECREF(seq);
+  return PyErr_Occurred() ? -1 : 0;
+}
+
+/*
+  Convert a 4x4 matrix in column major order to a C array. The matrix
+  may be given as a sequence of 16 numbers, or as 4 sequences of 4,
+  such as a 4x4 numpy array, which are taken in row order. Returns 0
+  on success.
+*/
+static int get_matrix (PyObject *obj, float *mat)
+{
+  PyObject *seq;
+  register int i;
+
+  seq = PySequence_Fast(obj, "transformation must be a sequence");
+  if (!seq)
+    return -1;
+  if (PySequence_Fast_GET_SIZE(seq) == 4) {
+    for (i=0; i < 4; i++)
+      if (get_numbers(PySequence_Fast_GET_ITEM(seq, i), mat+4*i, 4))
+	break;
+  } else {
+    get_numbers (seq, mat, 16);
+  }
+  Py_DECREF(seq);
+  return PyErr_Occurred() ? -1 : 0;
+}
+
+/*
+  Return a contiguous single precision array of coordinates. Unless
+  'inplace' is set, other arrays and sequences are converted; if it
+  is set, 'obj' must be a writeable float32 array which is modified
+  in place.
+*/
+static PyArrayObject *xyz_array (PyObject *obj, int inplace)
+{
+  PyArrayObject *arr;
+
+  if (need_numpy())
+    return NULL;
+  if (inplace) {
+    if (!PyArray_Check(obj) || PyArray_TYPE((PyArrayObject *)obj) != NPY_FLOAT ||
+	!PyArray_ISCARRAY((PyArrayObject *)obj)) {
+      PyErr_SetString(PyExc_TypeError, "coordinates must be a writeable, contiguous float32 array");
+      return NULL;
+    }
+    Py_INCREF(obj);
+    arr = (PyArrayObject *)obj;
+  } else {
+    arr = (PyArrayObject *)PyArray_FROM_OTF(obj, NPY_FLOAT, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!arr)
+      return NULL;
+  }
+  if (PyArray_SIZE(arr) % 3 != 0) {
+    Py_DECREF(arr);
+    PyErr_SetString(PyExc_ValueError, "number of coordinates is not a multiple of 3");
+    return NULL;
+  }
+  return arr;
+}
+
+/*
+  Check the framing of a binary O file, and raise odbparser.error if
+  it is broken. If 'list' is given, the datablocks are returned in it.
+  The status of the file checked is returned in 'st'.
+*/
+static int check_file (char *fnam, odb_entry **list, int *n, struct stat *st)
+{
+  char msg[256];
+  odb_entry *l;
+  int nl, err;
+
+  if (binfil(fnam) == 0) {
+    PyErr_Format(ErrorObject, "%s: not a binary O file", fnam);
+    return -1;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  err = verify_framing(fnam, &l, &nl, st, msg);
+  Py_END_ALLOW_THREADS
+  if (err) {
+    PyErr_SetString(ErrorObject, msg);
+    return -1;
+  }
+  if (list) {
+    *list = l;
+    *n = nl;
+  } else {
+    free(l);
+  }
+  return 0;
+}
+
+/*
+  Raise odbparser.error if the file checked by check_file, with status
+  'st', has been changed or replaced since.
+*/
+static int check_unchanged (char *fnam, struct stat *st)
+{
+  struct stat now;
+
+  if (stat(fnam, &now) < 0 || !same_file(st, &now)) {
+    PyErr_Format(ErrorObject, "%s: file changed while it was read", fnam);
+    return -1;
+  }
+  return 0;
+}
+
+/* 1. Functions available in odbparser module */
+
+static PyObject *get (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"filename", "transform", "numpy", "shared", "verify", NULL};
+  char *fnam;
+  float mat[16], *m = NULL;
+  int usenumpy = 1, shared = 0, verify = 0;
+  struct stat st;
+  PyObject *pydict, *pymat = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Oppp", kwlist, &fnam, &pymat,
+				   &usenumpy, &shared, &verify))
+    return NULL;
+  if (verify && check_file(fnam, NULL, NULL, &st))
+    return NULL;
+  if (usenumpy && need_numpy())
+    return NULL;
+  if (pymat && pymat != Py_None) {
+    if (get_matrix(pymat, mat))
+      return NULL;
+    m = mat;
+  }
+  if (shared && (m || !usenumpy)) {
+    PyErr_SetString(PyExc_ValueError, "shared needs numpy, and no transform");
+    return NULL;
+  }
+
+  /* The shared memory cache falls back to reading the file */
+  pydict = NULL;
+  if (shared)
+    pydict = readshared(fnam, binfil(fnam) != 0);
+
+  /* Do the actual reading. The two subroutines readbinary and readformatted
+     both return a Python dictionary. */
+
+  if (!pydict && !PyErr_Occurred()) {
+    if (binfil(fnam)) {
+      //fprintf (stderr, "Reading binary O file\n");
+      pydict = readbinary(fnam, m, usenumpy);
+    }  else {
+      //fprintf (stderr, "Reading formatted O file\n");
+      pydict = readformatted(fnam, m, usenumpy);
+    }
+  }
+
+  /* What was decoded must be the file that was checked */
+  if (pydict && verify && check_unchanged(fnam, &st))
+    Py_CLEAR(pydict);
+  return pydict;
+}
+
+static PyObject *aget (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"filename", "transform", "numpy", "shared", "verify", NULL};
+  char *fnam;
+  int usenumpy = 1, shared = 0, verify = 0;
+  aget_job *job;
+  PyObject *pymat = NULL, *asyncio, *loop, *future, *capsule, *done, *r;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Oppp", kwlist, &fnam, &pymat,
+				   &usenumpy, &shared, &verify))
+    return NULL;
+  if (usenumpy && need_numpy())
+    return NULL;
+
+  job = calloc(1, sizeof(aget_job));
+  if (!job)
+    return PyErr_NoMemory();
+  job->usenumpy = usenumpy;
+  job->shared = shared;
+  job->verify = verify;
+  if (pymat && pymat != Py_None) {
+    if (get_matrix(pymat, job->mat)) {
+      free(job);
+      return NULL;
+    }
+    job->usemat = 1;
+  }
+  if (shared && (job->usemat || !usenumpy)) {
+    free(job);
+    PyErr_SetString(PyExc_ValueError, "shared needs numpy, and no transform");
+    return NULL;
+  }
+  job->fnam = strdup(fnam);
+  capsule = PyCapsule_New(job, "odbparser.job", aget_job_destructor);
+  if (!capsule) {
+    free(job->fnam);
+    free(job);
+    return NULL;
+  }
+  job->self = capsule;
+
+  asyncio = PyImport_ImportModule("asyncio");
+  if (!asyncio) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+  Py_DECREF(asyncio);
+  if (!loop) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  job->loop = loop;
+  future = PyObject_CallMethod(loop, "create_future", NULL);
+  if (!future) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  job->future = future;
+
+  job->finish = PyCFunction_New(&aget_finish_def, capsule);
+  done = PyCFunction_New(&aget_done_def, capsule);
+  r = done ? PyObject_CallMethod(future, "add_done_callback", "O", done) : NULL;
+  Py_XDECREF(done);
+  if (!r || !job->finish) {
+    Py_XDECREF(r);
+    Py_CLEAR(job->finish);
+    Py_CLEAR(job->future);
+    Py_CLEAR(job->loop);
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  Py_DECREF(r);
+
+  Py_INCREF(capsule);		// held by the thread
+  if (pool_submit(aget_work, job) < 0) {
+    Py_DECREF(capsule);
+    Py_CLEAR(job->finish);
+    Py_CLEAR(job->future);
+    Py_CLEAR(job->loop);
+    Py_DECREF(capsule);
+    PyErr_SetString(PyExc_RuntimeError, "cannot start reader thread");
+    return NULL;
+  }
+  Py_DECREF(capsule);
+  Py_INCREF(future);
+  return future;
+}
+
+static PyObject *read_slice (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"filename", "name", "start", "stop", "numpy", NULL};
+  char *fnam, *name, par[26];
+  Py_ssize_t start, stop;
+  int usenumpy = 1;
+  size_t i;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "ssnn|p", kwlist, &fnam, &name,
+				   &start, &stop, &usenumpy))
+    return NULL;
+  if (strlen(name) > 25) {
+    PyErr_SetString(PyExc_KeyError, name);
+    return NULL;
+  }
+  for (i=0; i <= strlen(name); i++)
+    par[i] = tolower(name[i]);
+  if (usenumpy && need_numpy())
+    return NULL;
+
+  if (binfil(fnam))
+    return slice_binary(fnam, par, start, stop, usenumpy);
+  return slice_formatted(fnam, par, start, stop, usenumpy);
+}
+
+static PyObject *verify (PyObject *self, PyObject *args)
+{
+  char *fnam;
+  odb_entry *list;
+  uint32_t *crc;
+  int i, n, err;
+  struct stat st;
+  PyObject *pydict, *pycrc;
+
+  if (!PyArg_ParseTuple(args, "s", &fnam))
+    return NULL;
+  if (check_file(fnam, &list, &n, &st))
+    return NULL;
+  crc = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  if (!crc) {
+    free(list);
+    return PyErr_NoMemory();
+  }
+  Py_BEGIN_ALLOW_THREADS
+  err = verify_crc(fnam, list, n, crc);
+  Py_END_ALLOW_THREADS
+  if (err) {
+    free(list);
+    free(crc);
+    PyErr_Format(ErrorObject, "%s: error reading datablocks", fnam);
+    return NULL;
+  }
+  if (check_unchanged(fnam, &st)) {
+    free(list);
+    free(crc);
+    return NULL;
+  }
+
+  pydict = PyDict_New();
+  for (i=0; i<n; i++) {
+    pycrc = PyLong_FromUnsignedLong(crc[i]);
+    PyDict_SetItemString(pydict, list[i].name, pycrc);
+    Py_DECREF(pycrc);
+  }
+  free(list);
+  free(crc);
+  return pydict;
+}
+
+static PyObject *diff (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"a", "b", "rtol", "atol", NULL};
+  char *fna, *fnb;
+  double rtol = 0, atol = 0;
+  int i;
+  int64_t count;
+  odb_file fa, fb;
+  odb_entry *ea, *eb;
+  PyObject *index, *added, *removed, *changed, *pyidx, *pykey;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|dd", kwlist, &fna, &fnb,
+				   &rtol, &atol))
+    return NULL;
+  if (odb_open(fna, binfil(fna) != 0, &fa) < 0)
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, fna);
+  if (odb_open(fnb, binfil(fnb) != 0, &fb) < 0) {
+    odb_close(&fa);
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, fnb);
+  }
+
+  // index the datablocks of b by name
+  index = PyDict_New();
+  for (i=0; i < fb.nblocks; i++) {
+    pyidx = PyLong_FromLong(i);
+    PyDict_SetItemString(index, fb.blocks[i].name, pyidx);
+    Py_DECREF(pyidx);
+  }
+
+  added = PyList_New(0);
+  removed = PyList_New(0);
+  changed = PyDict_New();
+  for (i=0; i < fa.nblocks; i++) {
+    ea = &fa.blocks[i];
+    pykey = PyUnicode_FromString(ea->name);
+    pyidx = PyDict_GetItem(index, pykey);
+    if (!pyidx) {
+      PyList_Append(removed, pykey);
+      Py_DECREF(pykey);
+      continue;
+    }
+    eb = &fb.blocks[PyLong_AsLong(pyidx)];
+    PyDict_DelItem(index, pykey);
+
+    Py_BEGIN_ALLOW_THREADS
+    count = diff_block(&fa, ea, &fb, eb, rtol, atol);
+    Py_END_ALLOW_THREADS
+    if (count < 0) {
+      PyErr_Format(PyExc_IOError, "error reading datablock %s", ea->name);
+      Py_DECREF(pykey);
+      break;
+    }
+    if (count > 0) {
+      pyidx = PyLong_FromLongLong(count);
+      PyDict_SetItem(changed, pykey, pyidx);
+      Py_DECREF(pyidx);
+    }
+    Py_DECREF(pykey);
+  }
+
+  // what is left in the index is only in b
+  for (i=0; i < fb.nblocks; i++) {
+    if (PyDict_GetItemString(index, fb.blocks[i].name)) {
+      pykey = PyUnicode_FromString(fb.blocks[i].name);
+      PyList_Append(added, pykey);
+      Py_DECREF(pykey);
+    }
+  }
+  Py_DECREF(index);
+  odb_close(&fa);
+  odb_close(&fb);
+
+  if (PyErr_Occurred()) {
+    Py_DECREF(added);
+    Py_DECREF(removed);
+    Py_DECREF(changed);
+    return NULL;
+  }
+  return Py_BuildValue("(NNN)", added, removed, changed);
+}
+
+static PyObject *unlink_shared (PyObject *self, PyObject *args)
+{
+  char *fnam;
+
+  if (!PyArg_ParseTuple(args, "s", &fnam))
+    return NULL;
+  if (shm_remove(fnam) < 0 && errno != ENOENT)
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, fnam);
+  Py_RETURN_NONE;
+}
+
+static PyObject *put_formatted (PyObject *self, PyObject *args)
+{
+  char *fnam, *par, typ;
+  PyObject *mapping, *items, *item, *pykey, *value, *t;
+  FILE *fp;
+  Py_ssize_t i;
+
+  if (!PyArg_ParseTuple(args, "sO" , &fnam, &mapping))
+    return NULL;
+  if (need_numpy())
+    return NULL;
+
+  items = PyMapping_Items(mapping);
+  if (!items)
+    return NULL;
+
+  fp = fopen(fnam, "w");
+  if (!fp) {
+    Py_DECREF(items);
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fnam);
+  }
+  setvbuf (fp, NULL, _IOFBF, 1<<20); // write in large chunks
+
+  for (i=0; i < PyList_GET_SIZE(items); i++) {
+    item = PyList_GET_ITEM(items, i);
+    pykey = PyTuple_GET_ITEM(item, 0);
+    value = PyTuple_GET_ITEM(item, 1);
+    par = (char *)PyUnicode_AsUTF8(pykey);
+    if (!par)
+      break;
+
+    /* A value of the form (type, data) gives the datablock type explicitly */
+    typ = 0;
+    if (PyTuple_Check(value) && PyTuple_GET_SIZE(value) == 2) {
+      t = PyTuple_GET_ITEM(value, 0);
+      if (PyUnicode_Check(t) && PyUnicode_GET_LENGTH(t) == 1 &&
+	  !PyUnicode_Check(PyTuple_GET_ITEM(value, 1)) &&
+	  !PyBytes_Check(PyTuple_GET_ITEM(value, 1))) {
+	typ = toupper(PyUnicode_READ_CHAR(t, 0));
+	value = PyTuple_GET_ITEM(value, 1);
+      }
+    }
+    if (writeblock(fp, par, typ, value))
+      break;
+  }
+  Py_DECREF(items);
+
+  if (fclose(fp) && !PyErr_Occurred())
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, fnam);
+  if (PyErr_Occurred())
+    return NULL;
+  Py_RETURN_NONE;
+}
+
+
+/*
+  Copy a numeric datablock from a Python object into a newly
+  allocated C array of 'type' (NPY_INT or NPY_FLOAT). The number of
+  elements is returned in 'n'.
+*/
+static void *array_copy (PyObject *obj, int type, int64_t *n)
+{
+  PyArrayObject *arr;
+  void *data;
+
+  arr = (PyArrayObject *)PyArray_FROM_OTF(obj, type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+  if (!arr)
+    return NULL;
+  *n = PyArray_SIZE(arr);
+  data = malloc(PyArray_NBYTES(arr) + 4);
+  if (data)
+    memcpy (data, PyArray_DATA(arr), PyArray_NBYTES(arr));
+  else
+    PyErr_NoMemory();
+  Py_DECREF(arr);
+  return data;
+}
+
+/*
+  Copy a sequence of strings into a newly allocated array of O
+  character variables, 6 characters each, padded with spaces.
+*/
+static char *c6_copy (PyObject *obj, int64_t *n)
+{
+  PyObject *seq, *item;
+  Py_ssize_t i, len;
+  char *data, *s;
+
+  seq = PySequence_Fast(obj, "expected a sequence of strings");
+  if (!seq)
+    return NULL;
+  *n = PySequence_Fast_GET_SIZE(seq);
+  data = malloc(6*(*n) + 1);
+  if (!data) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  memset (data, ' ', 6*(*n));
+  for (i=0; i < *n; i++) {
+    item = PySequence_Fast_GET_ITEM(seq, i);
+    if (PyBytes_Check(item)) {
+      s = PyBytes_AS_STRING(item);
+      len = PyBytes_GET_SIZE(item);
+    } else if (PyUnicode_Check(item)) {
+      s = (char *)PyUnicode_AsUTF8AndSize(item, &len);
+      if (!s)
+	break;
+    } else {
+      PyErr_SetString(PyExc_TypeError, "expected a sequence of strings");
+      break;
+    }
+    memcpy (data+6*i, s, len < 6 ? len : 6);
+  }
+  Py_DECREF(seq);
+  if (PyErr_Occurred()) {
+    free (data);
+    return NULL;
+  }
+  return data;
+}
+
+/*
+  Get the datablocks of molecule 'mol' either from an O file, or from
+  a dictionary or Database of datablocks. The residue pointers are 32
+  bit atom numbers, so as in read_molecule, molecules that do not fit
+  in an int are rejected. Returns 0 on success, else -1 with a Python
+  exception set.
+*/
+static int get_molecule (PyObject *src, char *mol, odb_molecule *m)
+{
+  char *fnam, name[64];
+  int errcod, binary, n;
+  int64_t natoms = 0, nres = 0, nxyz = 0, nb = 0, nwt = 0, nrtyp = 0, nrptr = 0;
+  static char *suffix[] = {"atom_xyz", "atom_name", "atom_b", "atom_wt",
+			   "residue_name", "residue_type", "residue_pointers"};
+  PyObject *obj;
+  register int i;
+
+  if (PyUnicode_Check(src)) {
+    fnam = (char *)PyUnicode_AsUTF8(src);
+    if (!fnam)
+      return -1;
+    binary = binfil(fnam);
+    Py_BEGIN_ALLOW_THREADS
+    errcod = read_molecule(fnam, binary, mol, m);
+    Py_END_ALLOW_THREADS
+    if (errcod == -1) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, fnam);
+      return -1;
+    }
+    if (errcod) {
+      PyErr_Format(PyExc_KeyError, "molecule %s not found or incomplete in %s", mol, fnam);
+      return -1;
+    }
+    return 0;
+  }
+
+  /* A mapping of datablocks, as returned by get() */
+  if (need_numpy())
+    return -1;
+  memset (m, 0, sizeof(odb_molecule));
+  for (i=0; i < 7; i++) {
+    snprintf (name, 64, "%s_%s", mol, suffix[i]);
+    for (n=0; name[n]; n++)
+      name[n] = tolower(name[n]);
+    obj = PyMapping_GetItemString(src, name);
+    if (!obj) {
+      if (i == 2 || i == 3) {	// B-factors and occupancies are optional
+	PyErr_Clear();
+	continue;
+      }
+      break;
+    }
+    switch (i) {
+    case 0: m->xyz = array_copy(obj, NPY_FLOAT, &nxyz); break;
+    case 1: m->atom_name = c6_copy(obj, &natoms); break;
+    case 2: m->b = array_copy(obj, NPY_FLOAT, &nb); break;
+    case 3: m->wt = array_copy(obj, NPY_FLOAT, &nwt); break;
+    case 4: m->res_name = c6_copy(obj, &nres); break;
+    case 5: m->res_type = c6_copy(obj, &nrtyp); break;
+    case 6: m->res_ptr = array_copy(obj, NPY_INT, &nrptr); break;
+    }
+    Py_DECREF(obj);
+    if (PyErr_Occurred())
+      break;
+    if (i == 0 && nxyz % 3 != 0) {
+      PyErr_Format(PyExc_ValueError, "%s: size is not a multiple of 3", name);
+      break;
+    }
+  }
+  if (!PyErr_Occurred() && (natoms > INT_MAX/3 || nres > INT_MAX/2))
+    PyErr_Format(PyExc_ValueError, "molecule %s is too large", mol);
+  if (!PyErr_Occurred()) {
+    m->natoms = natoms;
+    m->nres = nres;
+    if (nb != natoms) {
+      free (m->b);
+      m->b = NULL;
+    }
+    if (nwt != natoms) {
+      free (m->wt);
+      m->wt = NULL;
+    }
+    if (nxyz != 3*natoms || nrtyp != nres || nrptr != 2*nres || check_molecule(m))
+      PyErr_Format(PyExc_ValueError, "datablocks of molecule %s are inconsistent", mol);
+  }
+  if (PyErr_Occurred()) {
+    free_molecule (m);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Common part of to_pdb and to_mmcif.
+*/
+static PyObject *write_coordinates (PyObject *args, int cif)
+{
+  char *mol, *out;
+  PyObject *src;
+  odb_molecule m;
+  int fd;
+  long n;
+
+  if (!PyArg_ParseTuple(args, "Oss" , &src, &mol, &out))
+    return NULL;
+  if (get_molecule(src, mol, &m))
+    return NULL;
+
+  fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free_molecule (&m);
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, out);
+  }
+  Py_BEGIN_ALLOW_THREADS
+  n = cif ? write_mmcif(fd, mol, &m) : write_pdb(fd, &m);
+  if (close(fd) && n >= 0)
+    n = -1;
+  Py_END_ALLOW_THREADS
+  free_molecule (&m);
+
+  if (n < 0)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, out);
+  return PyLong_FromLong(n);
+}
+
+static PyObject *to_pdb (PyObject *self, PyObject *args)
+{
+  return write_coordinates(args, 0);
+}
+
+static PyObject *to_mmcif (PyObject *self, PyObject *args)
+{
+  return write_coordinates(args, 1);
+}
+
+static PyObject *transform (PyObject *self, PyObject *args)
+{
+  PyObject *obj, *pymat;
+  PyArrayObject *arr;
+  float mat[16];
+
+  if (!PyArg_ParseTuple(args, "OO" , &obj, &pymat))
+    return NULL;
+  if (get_matrix(pymat, mat))
+    return NULL;
+  arr = xyz_array(obj, 1);
+  if (!arr)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  xyz_transform (PyArray_DATA(arr), PyArray_SIZE(arr)/3, mat, 0);
+  Py_END_ALLOW_THREADS
+  return (PyObject *)arr;
+}
+
+static PyObject *centroid (PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  PyArrayObject *arr;
+  double c[3];
+  float lo[3], hi[3];
+
+  if (!PyArg_ParseTuple(args, "O" , &obj))
+    return NULL;
+  arr = xyz_array(obj, 0);
+  if (!arr)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  xyz_extent (PyArray_DATA(arr), PyArray_SIZE(arr)/3, c, lo, hi);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(arr);
+  return Py_BuildValue("(ddd)", c[0], c[1], c[2]);
+}
+
+static PyObject *bbox (PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  PyArrayObject *arr;
+  double c[3];
+  float lo[3], hi[3];
+
+  if (!PyArg_ParseTuple(args, "O" , &obj))
+    return NULL;
+  arr = xyz_array(obj, 0);
+  if (!arr)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  xyz_extent (PyArray_DATA(arr), PyArray_SIZE(arr)/3, c, lo, hi);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(arr);
+  return Py_BuildValue("((ddd)(ddd))", lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+}
+
+static PyObject *rmsd (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"a", "b", "fit", NULL};
+  PyObject *obja, *objb;
+  PyArrayObject *a, *b;
+  int fit = 1;
+  double r;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|p", kwlist, &obja, &objb, &fit))
+    return NULL;
+  a = xyz_array(obja, 0);
+  if (!a)
+    return NULL;
+  b = xyz_array(objb, 0);
+  if (!b) {
+    Py_DECREF(a);
+    return NULL;
+  }
+  if (PyArray_SIZE(a) != PyArray_SIZE(b)) {
+    Py_DECREF(a);
+    Py_DECREF(b);
+    PyErr_SetString(PyExc_ValueError, "coordinate sets differ in size");
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  r = xyz_rmsd(PyArray_DATA(a), PyArray_DATA(b), PyArray_SIZE(a)/3, fit);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(a);
+  Py_DECREF(b);
+  return PyFloat_FromDouble(r);
+}
+
+/* 2. Doc strings */
+
+static char odbparser_module__doc__[] =
+"Parse O binary and formatted files";
+
+static char odbparser_get__doc__[] =
+"get(filename, transform=None, numpy=True, shared=False, verify=False) -- return dictionary of O datablocks.\n"
+"If transform is a 4x4 column major matrix, such as .gs_real[4:20], it is\n"
+"applied to the coordinates of all molecules as they are read. If numpy is\n"
+"false, integer and real datablocks are returned as odbparser.Array objects\n"
+"and numpy is not imported. If shared is true, the file is decoded once into\n"
+"shared memory, and integer and real datablocks are read-only arrays using it.\n"
+"If verify is true, the record framing of a binary file is checked before it\n"
+"is read, and odbparser.error is raised if it is broken.";
+
+static char odbparser_verify__doc__[] =
+"verify(filename) -- check the record framing of a binary O file, and return a\n"
+"dictionary with the CRC32C of the data of every datablock. Raises odbparser.error\n"
+"if the file is truncated or corrupt.";
+
+static char odbparser_diff__doc__[] =
+"diff(a, b, rtol=0, atol=0) -- compare two O files, return (added, removed, changed).\n"
+"added and removed are lists of the datablocks found only in b or only in a.\n"
+"changed maps the names of datablocks that differ to the number of elements that\n"
+"differ. Numbers are equal if |a - b| <= atol + rtol*|b|.";
+
+static char odbparser_unlink_shared__doc__[] =
+"unlink_shared(filename) -- remove the shared memory copy of filename";
+
+static char odbparser_aget__doc__[] =
+"aget(filename, transform=None, numpy=True, shared=False, verify=False) -- awaitable\n"
+"version of get().\n"
+"The file is read on a thread of the module, without blocking the event loop.\n"
+"Cancelling the returned future stops the reading.";
+
+static char odbparser_read_slice__doc__[] =
+"read_slice(filename, name, start, stop, numpy=True) -- return elements start:stop\n"
+"of a datablock, reading only that part of the file. For coordinate datablocks\n"
+"the elements are atoms.";
+
+static char odbparser_put_formatted__doc__[] =
+"put_formatted(filename, mapping) -- write datablocks to a formatted O file";
+
+static char odbparser_to_pdb__doc__[] =
+"to_pdb(filename_or_db, mol, out) -- write molecule to a PDB file, return number of atoms";
+
+static char odbparser_to_mmcif__doc__[] =
+"to_mmcif(filename_or_db, mol, out) -- write molecule to an mmCIF file, return number of atoms";
+
+static char odbparser_transform__doc__[] =
+"transform(xyz, mat) -- apply a 4x4 column major matrix to a float32 coordinate array in place";
+
+static char odbparser_centroid__doc__[] =
+"centroid(xyz) -- return the centroid (x, y, z) of a coordinate array";
+
+static char odbparser_bbox__doc__[] =
+"bbox(xyz) -- return the bounding box ((xmin, ymin, zmin), (xmax, ymax, zmax))";
+
+static char odbparser_rmsd__doc__[] =
+"rmsd(a, b, fit=True) -- root mean square deviation, after superposition if fit is true";
+
+
+/* 3. Method table mapping names to wrappers */
+
+static PyMethodDef odbparser_methods[] = {
+  {"get", (PyCFunction)get,   METH_VARARGS | METH_KEYWORDS, odbparser_get__doc__ },
+  {"verify", (PyCFunction)verify, METH_VARARGS, odbparser_verify__doc__ },
+  {"diff", (PyCFunction)diff, METH_VARARGS | METH_KEYWORDS, odbparser_diff__doc__ },
+  {"unlink_shared", (PyCFunction)unlink_shared, METH_VARARGS, odbparser_unlink_shared__doc__ },
+  {"aget", (PyCFunction)aget, METH_VARARGS | METH_KEYWORDS, odbparser_aget__doc__ },
+  {"read_slice", (PyCFunction)read_slice, METH_VARARGS | METH_KEYWORDS, odbparser_read_slice__doc__ },
+  {"put_formatted", (PyCFunction)put_formatted, METH_VARARGS, odbparser_put_formatted__doc__ },
+  {"to_pdb", (PyCFunction)to_pdb, METH_VARARGS, odbparser_to_pdb__doc__ },
+  {"to_mmcif", (PyCFunction)to_mmcif, METH_VARARGS, odbparser_to_mmcif__doc__ },
+  {"transform", (PyCFunction)transform, METH_VARARGS, odbparser_transform__doc__ },
+  {"centroid", (PyCFunction)centroid, METH_VARARGS, odbparser_centroid__doc__ },
+  {"bbox", (PyCFunction)bbox, METH_VARARGS, odbparser_bbox__doc__ },
+  {"rmsd", (PyCFunction)rmsd, METH_VARARGS | METH_KEYWORDS, odbparser_rmsd__doc__ },
+  {NULL, (PyCFunction)NULL, 0, NULL} /* sentinel */
+};
+
+
+/* 4. Module initialization function */
+
+static struct PyModuleDef moduledef = {
+  PyModuleDef_HEAD_INIT,
+  "odbparser",             /* name of module */
+  odbparser_module__doc__, /* module documentation */
+  -1,                      /* m_size */
+  odbparser_methods,       /* methods */
+  NULL,                    /* m_reload */
+  NULL,                    /* m_traverse */
+  NULL,                    /* m_clear */
+  NULL                     /* m_free */
+};
+
+
+PyMODINIT_FUNC PyInit_odbparser(void) {
+  PyObject *m, *d;
+
+  /* Create the module and add the functions */
+  m = PyModule_Create(&moduledef);
+
+  /* Add some symbolic constants to the module */
+  d = PyModule_GetDict(m);
+  ErrorObject = PyErr_NewException("odbparser.error", NULL, NULL);
+  PyDict_SetItemString(d, "error", ErrorObject);
+
+  if (PyType_Ready(&ArrayType) == 0) {
+    Py_INCREF(&ArrayType);
+    PyModule_AddObject(m, "Array", (PyObject *)&ArrayType);
+  }
+  if (PyType_Ready(&DatabaseType) == 0) {
+    Py_INCREF(&DatabaseType);
+    PyModule_AddObject(m, "Database", (PyObject *)&DatabaseType);
+  }
 
   /* Check for errors */
   if (PyErr_Occurred())
@@ -0,0 +1,140 @@
+"""
+Make small O files for the tests.
+
+Binary files are written as O writes them: big-endian fortran records,
+a 30 byte header record (name, type, size) followed by a data record
+for every datablock. Datablocks are given as (name, type, data), where
+data is a list of numbers for types I and R, a list of byte strings of
+at most 6 characters for type C, and a list of lines for type T.
+"""
+
+import os
+import struct
+import tempfile
+import unittest
+
+
+def record(payload, parts=1):
+    """Return a fortran record, split into 'parts' subrecords as
+    gfortran does for records over 2 GB."""
+    n = len(payload)
+    cuts = [n*i//parts for i in range(parts+1)]
+    out = b''
+    for i in range(parts):
+        chunk = payload[cuts[i]:cuts[i+1]]
+        lead = -len(chunk) if i < parts-1 else len(chunk)
+        trail = -len(chunk) if i > 0 else len(chunk)
+        out += struct.pack('>i', lead) + chunk + struct.pack('>i', trail)
+    return out
+
+
+def payload(typ, data):
+    if typ == 'I':
+        return struct.pack('>%di' % len(data), *data)
+    if typ == 'R':
+        return struct.pack('>%df' % len(data), *data)
+    if typ == 'C':
+        return b''.join(s.ljust(6) for s in data)
+    return b''.join(s.encode() + b'\r' for s in data)
+
+
+def size(typ, data):
+    return len(payload(typ, data)) if typ == 'T' else len(data)
+
+
+def header(name, typ, n):
+    return record(name.upper().ljust(25).encode() + typ.encode() + struct.pack('>i', n))
+
+
+def binary(blocks, parts=1):
+    """Return the contents of a binary O file."""
+    out = b''
+    for name, typ, data in blocks:
+        out += header(name, typ, size(typ, data)) + record(payload(typ, data), parts)
+    return out
+
+
+def formatted(blocks):
+    """Return the contents of a formatted O file."""
+    out = ''
+    for name, typ, data in blocks:
+        if typ == 'I':
+            out += '%-25s %s %10d (6(1x,i11))\n' % (name.upper(), typ, len(data))
+            for i in range(0, len(data), 6):
+                out += ''.join(' %11d' % v for v in data[i:i+6]) + '\n'
+        elif typ == 'R':
+            out += '%-25s %s %10d (5(1x,e15.8))\n' % (name.upper(), typ, len(data))
+            for i in range(0, len(data), 5):
+                out += ''.join(' %15.8e' % v for v in data[i:i+5]) + '\n'
+        elif typ == 'C':
+            out += '%-25s %s %10d (10(1x,a6))\n' % (name.upper(), typ, len(data))
+            for i in range(0, len(data), 10):
+                out += ''.join(' %-6s' % s.decode() for s in data[i:i+10]) + '\n'
+        else:
+            reclen = max([72] + [len(s) for s in data])
+            out += '%-25s %s %10d %d\n' % (name.upper(), typ, len(data), reclen)
+            out += ''.join(s.ljust(reclen) + '\n' for s in data)
+    return out
+
+
+def molecule(mol, natoms=8, seed=1):
+    """Return the datablocks of a small molecule with residues of
+    four atoms."""
+    nres = natoms // 4
+    xyz = [((i * 7919 + seed * 104729) % 10007) / 100.0 - 50.0 for i in range(3*natoms)]
+    pointers = []
+    for i in range(nres):
+        pointers += [4*i+1, 4*i+4]
+    return [
+        (mol + '_atom_xyz', 'R', xyz),
+        (mol + '_atom_name', 'C', [b'N', b'CA', b'C', b'O'] * nres),
+        (mol + '_atom_b', 'R', [20.0 + i for i in range(natoms)]),
+        (mol + '_atom_wt', 'R', [1.0] * natoms),
+        (mol + '_residue_name', 'C', [str(i+1).encode() for i in range(nres)]),
+        (mol + '_residue_type', 'C', [[b'ALA', b'GLY'][i % 2] for i in range(nres)]),
+        (mol + '_residue_pointers', 'I', pointers),
+    ]
+
+
+def standard():
+    """A few datablocks of every type, and a molecule."""
+    return [
+        ('.gs_real', 'R', [i / 7.0 for i in range(28)]),
+        ('.sam_integer', 'I', [1, 2, 3, -4, 5]),
+        ('.names', 'C', [b'ABC', b'DEF', b'GHI']),
+        ('.help_text', 'T', ['hello world', 'second line']),
+    ] + molecule('a')
+
+
+class TestCase(unittest.TestCase):
+    """A test case with a directory for its files."""
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.addCleanup(self.tmp.cleanup)
+
+    def path(self, name):
+        return os.path.join(self.tmp.name, name)
+
+    def write(self, name, contents):
+        path = self.path(name)
+        with open(path, 'wb' if isinstance(contents, bytes) else 'w') as f:
+            f.write(contents)
+        return path
+
+    def assertBlocksEqual(self, db, blocks, places=None):
+        """Check the datablocks returned by get() against 'blocks'."""
+        self.assertEqual(sorted(db.keys()), sorted(name for name, typ, data in blocks))
+        for name, typ, data in blocks:
+            value = db[name]
+            if typ == 'C':
+                value = [s if isinstance(s, bytes) else s.encode() for s in value]
+            if typ == 'R' and places is None:
+                # compare at single precision
+                data = struct.unpack('%df' % len(data), struct.pack('%df' % len(data), *data))
+            if typ == 'R' and places is not None:
+                for a, b in zip(list(value), data):
+                    self.assertAlmostEqual(a, b, places=places)
+                self.assertEqual(len(value), len(data))
+            else:
+                self.assertEqual(list(value), list(data), name)
@@ -0,0 +1,131 @@
+import asyncio
+import os
+import subprocess
+import sys
+import unittest
+
+import odbparser
+import odbfiles
+
+
+def run(func, *args, **kwds):
+    """Await func(*args, **kwds) in a new event loop, failing on errors
+    reported to the loop's exception handler, such as a result set on
+    a cancelled future."""
+    errors = []
+
+    async def main():
+        asyncio.get_running_loop().set_exception_handler(lambda loop, ctx: errors.append(ctx))
+        return await func(*args, **kwds)
+
+    result = asyncio.run(main())
+    if errors:
+        raise AssertionError(errors)
+    return result
+
+
+class AgetTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard()
+        self.binary = self.write('db.o', odbfiles.binary(self.blocks))
+        self.formatted = self.write('db.fo', odbfiles.formatted(self.blocks))
+
+    def test_result(self):
+        for fnam in (self.binary, self.formatted):
+            db = run(odbparser.aget, fnam)
+            self.assertBlocksEqual(db, self.blocks)
+            self.assertTrue(db['.gs_real'].flags.writeable)
+            db = run(odbparser.aget, fnam, numpy=False)
+            self.assertIsInstance(db['.gs_real'], odbparser.Array)
+            self.assertBlocksEqual(db, self.blocks)
+
+    def test_transform(self):
+        mat = [0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1, 0, 10, 20, 30, 1]
+        want = odbparser.get(self.binary, transform=mat)
+        got = run(odbparser.aget, self.binary, transform=mat)
+        self.assertEqual(got['a_atom_xyz'].tolist(), want['a_atom_xyz'].tolist())
+
+    def test_many(self):
+        async def many():
+            return await asyncio.gather(*[odbparser.aget(f) for f in [self.binary, self.formatted] * 10])
+        for db in run(many):
+            self.assertBlocksEqual(db, self.blocks)
+
+    @unittest.skipUnless(os.path.isdir('/dev/shm'), 'no /dev/shm')
+    def test_shared(self):
+        self.addCleanup(odbparser.unlink_shared, self.binary)
+        for i in range(2):
+            db = run(odbparser.aget, self.binary, shared=True)
+            self.assertBlocksEqual(db, self.blocks)
+            self.assertFalse(db['.gs_real'].flags.writeable)
+        with self.assertRaises(ValueError):
+            run(odbparser.aget, self.binary, shared=True, numpy=False)
+        with self.assertRaises(ValueError):
+            run(odbparser.aget, self.binary, shared=True, transform=[1] * 16)
+
+    def test_verify(self):
+        self.assertBlocksEqual(run(odbparser.aget, self.binary, verify=True), self.blocks)
+        with self.assertRaisesRegex(odbparser.error, 'not a binary O file'):
+            run(odbparser.aget, self.formatted, verify=True)
+        contents = bytearray(odbfiles.binary(self.blocks))
+        contents[30 + 8] ^= 0x40		# the leading marker of the first data record
+        bad = self.write('bad.o', bytes(contents))
+        with self.assertRaises(odbparser.error):
+            run(odbparser.aget, bad, verify=True)
+
+    def test_errors(self):
+        with self.assertRaises(OSError):
+            run(odbparser.aget, self.path('missing.o'))
+        short = self.write('short.o', odbfiles.binary(self.blocks)[:-20])
+        with self.assertRaises(OSError):
+            run(odbparser.aget, short)
+        # a text datablock with fewer lines than it claims
+        text = '.HELP_TEXT                T          5         72\nhello\nworld\n'
+        with self.assertRaises(OSError):
+            run(odbparser.aget, self.write('short.fo', text))
+        with self.assertRaises(RuntimeError):
+            odbparser.aget(self.binary)		# no running loop
+
+    def test_cancel(self):
+        big = self.write('big.o', odbfiles.binary(odbfiles.molecule('m', natoms=50000)))
+
+        async def cancel():
+            futures = [odbparser.aget(big) for i in range(20)]
+            for f in futures:
+                f.cancel()
+            for f in futures:
+                with self.assertRaises(asyncio.CancelledError):
+                    await f
+            # give the threads time to finish
+            await asyncio.sleep(0.2)
+            return await odbparser.aget(self.binary)
+
+        self.assertBlocksEqual(run(cancel), self.blocks)
+
+    def test_wait_for(self):
+        big = self.write('big.o', odbfiles.binary(odbfiles.molecule('m', natoms=50000)))
+
+        async def timeout():
+            with self.assertRaises(asyncio.TimeoutError):
+                await asyncio.wait_for(odbparser.aget(big), 0)
+            await asyncio.sleep(0.2)
+
+        run(timeout)
+
+    def test_exit_while_reading(self):
+        # the interpreter exits with reads still going on
+        big = self.write('big.o', odbfiles.binary(odbfiles.molecule('m', natoms=50000)))
+        code = ('import asyncio, sys, odbparser\n'
+                'async def main():\n'
+                '    for i in range(8):\n'
+                '        odbparser.aget(sys.argv[1])\n'
+                'asyncio.run(main())\n')
+        for i in range(5):
+            subprocess.run([sys.executable, '-c', code, big], check=True, timeout=60,
+                           env=dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path)))
+
+
+if __name__ == '__main__':
+    unittest.main()
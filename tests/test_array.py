@@ -0,0 +1,132 @@
+import ctypes
+import os
+import struct
+import subprocess
+import sys
+import unittest
+
+import numpy
+
+import odbparser
+import odbfiles
+
+
+class Py_buffer(ctypes.Structure):
+    _fields_ = [('buf', ctypes.c_void_p), ('obj', ctypes.c_void_p),
+                ('len', ctypes.c_ssize_t), ('itemsize', ctypes.c_ssize_t),
+                ('readonly', ctypes.c_int), ('ndim', ctypes.c_int),
+                ('format', ctypes.c_char_p), ('shape', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('strides', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('suboffsets', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('internal', ctypes.c_void_p)]
+
+
+PyBUF_SIMPLE = 0
+PyBUF_FORMAT = 0x0004
+PyBUF_ND = 0x0008
+PyBUF_STRIDES = 0x0010 | PyBUF_ND
+
+
+def getbuffer(obj, flags):
+    """Return (len, itemsize, format, shape, strides) of the buffer
+    exported with 'flags'."""
+    view = Py_buffer()
+    get = ctypes.pythonapi.PyObject_GetBuffer
+    get.argtypes = [ctypes.py_object, ctypes.POINTER(Py_buffer), ctypes.c_int]
+    if get(obj, ctypes.byref(view), flags) != 0:
+        raise BufferError
+    try:
+        return (view.len, view.itemsize, view.format,
+                view.shape[0] if view.shape else None,
+                view.strides[0] if view.strides else None)
+    finally:
+        ctypes.pythonapi.PyBuffer_Release(ctypes.byref(view))
+
+
+class ArrayTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard()
+        self.fnam = self.write('db.o', odbfiles.binary(self.blocks))
+        self.db = odbparser.get(self.fnam, numpy=False)
+
+    def test_sequence(self):
+        ints = self.db['.sam_integer']
+        self.assertIsInstance(ints, odbparser.Array)
+        self.assertEqual(len(ints), 5)
+        self.assertEqual(list(ints), [1, 2, 3, -4, 5])
+        self.assertEqual(ints.typecode, 'i')
+        self.assertEqual(self.db['.gs_real'].typecode, 'f')
+        self.assertEqual(repr(ints), '<odbparser.Array type I, 5 elements>')
+        with self.assertRaises(IndexError):
+            ints[5]
+
+    def test_memoryview(self):
+        m = memoryview(self.db['.gs_real'])
+        self.assertEqual((m.format, m.itemsize, m.shape, m.nbytes), ('f', 4, (28,), 112))
+        self.assertEqual(m.tolist(), list(struct.unpack('28f', struct.pack('28f', *self.blocks[0][2]))))
+        m = memoryview(self.db['.sam_integer'])
+        self.assertEqual(m.format, 'i')
+        self.assertEqual(m.tolist(), [1, 2, 3, -4, 5])
+        self.assertEqual(m.cast('B').nbytes, 20)
+
+    def test_numpy(self):
+        ints = self.db['.sam_integer']
+        a = numpy.asarray(ints)
+        self.assertEqual(a.dtype, numpy.int32)
+        self.assertEqual(a.tolist(), [1, 2, 3, -4, 5])
+        # the data is shared, not copied
+        a[0] = 10
+        self.assertEqual(ints[0], 10)
+
+    def test_without_format(self):
+        reals = self.db['.gs_real']
+        # a consumer that does not ask for the format sees bytes
+        self.assertEqual(getbuffer(reals, PyBUF_SIMPLE), (112, 1, None, None, None))
+        self.assertEqual(getbuffer(reals, PyBUF_ND), (112, 1, None, 112, None))
+        self.assertEqual(getbuffer(reals, PyBUF_STRIDES), (112, 1, None, 112, 1))
+        self.assertEqual(getbuffer(reals, PyBUF_STRIDES | PyBUF_FORMAT), (112, 4, b'f', 28, 4))
+        self.assertEqual(len(bytes(reals)), 112)
+
+
+class MatrixTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.fnam = self.write('db.o', odbfiles.binary(odbfiles.standard()))
+        self.mat = [0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1, 0, 10, 20, 30, 1]
+
+    def test_nested(self):
+        want = odbparser.get(self.fnam, transform=self.mat)['a_atom_xyz'].tolist()
+        nested = [self.mat[i:i+4] for i in range(0, 16, 4)]
+        for mat in (nested, tuple(map(tuple, nested)), numpy.array(self.mat).reshape(4, 4),
+                    numpy.array(self.mat, dtype=numpy.float32)):
+            db = odbparser.get(self.fnam, transform=mat)
+            self.assertEqual(db['a_atom_xyz'].tolist(), want)
+        xyz = numpy.array([1, 2, 3], dtype=numpy.float32)
+        self.assertEqual(odbparser.transform(xyz, nested).tolist(), [8, 21, 33])
+
+    def test_bad_matrix(self):
+        for mat in ([0] * 15, [[0] * 4] * 3, [[0] * 3] * 4, [[0] * 4] * 3 + [[0] * 5], numpy.zeros(17)):
+            with self.assertRaisesRegex(ValueError, '16 elements, or 4 rows of 4'):
+                odbparser.get(self.fnam, transform=mat)
+        with self.assertRaises(TypeError):
+            odbparser.get(self.fnam, transform=[0, 0, 0, 0])
+        with self.assertRaises(TypeError):
+            odbparser.get(self.fnam, transform=['a'] * 16)
+
+    def test_without_numpy(self):
+        code = ('import sys, odbparser\n'
+                'db = odbparser.get(sys.argv[1], numpy=False, transform=%r)\n'
+                'assert "numpy" not in sys.modules\n'
+                'print(list(db["a_atom_xyz"])[:3])\n'
+                % [self.mat[i:i+4] for i in range(0, 16, 4)])
+        out = subprocess.check_output([sys.executable, '-c', code, self.fnam],
+                                      env=dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path)))
+        want = odbparser.get(self.fnam, transform=self.mat)['a_atom_xyz'][:3].tolist()
+        self.assertEqual(eval(out), want)
+
+
+if __name__ == '__main__':
+    unittest.main()
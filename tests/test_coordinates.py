@@ -0,0 +1,130 @@
+import random
+import struct
+import unittest
+
+import odbparser
+import odbfiles
+
+
+def float32(x):
+    return struct.unpack('f', struct.pack('f', x))[0]
+
+
+class CoordinatesTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard() + odbfiles.molecule('b', natoms=12, seed=2)
+        self.fnam = self.write('db.o', odbfiles.binary(self.blocks))
+
+    def block(self, name, blocks=None):
+        for n, t, d in blocks or self.blocks:
+            if n == name:
+                return d
+
+    def pdb(self, src, mol='b'):
+        out = self.path('out.pdb')
+        n = odbparser.to_pdb(src, mol, out)
+        with open(out) as f:
+            return n, f.read().splitlines()
+
+    def cif(self, src, mol='b'):
+        out = self.path('out.cif')
+        n = odbparser.to_mmcif(src, mol, out)
+        with open(out) as f:
+            return n, f.read().splitlines()
+
+    def atoms(self, lines):
+        return [s for s in lines if s.startswith('ATOM')]
+
+    def test_pdb_columns(self):
+        n, lines = self.pdb(self.fnam)
+        atoms = self.atoms(lines)
+        self.assertEqual(n, 12)
+        self.assertEqual(len(atoms), 12)
+        xyz = self.block('b_atom_xyz')
+        b = self.block('b_atom_b')
+        for i, s in enumerate(atoms):
+            self.assertEqual(len(s), 78)
+            self.assertEqual(int(s[6:11]), i+1)
+            self.assertEqual(s[12:16].strip(), ['N', 'CA', 'C', 'O'][i % 4])
+            self.assertEqual(s[17:20], ['ALA', 'GLY'][i // 4 % 2])
+            self.assertEqual(int(s[22:26]), i // 4 + 1)
+            for k in range(3):
+                self.assertEqual(s[30+8*k:38+8*k], '%8.3f' % float32(xyz[3*i+k]))
+            self.assertEqual(s[54:60], '%6.2f' % 1.0)
+            self.assertEqual(s[60:66], '%6.2f' % float32(b[i]))
+            self.assertEqual(s[76:78], ' ' + s[13])
+        self.assertTrue(lines[-2].startswith('TER   %5d' % 13))
+        self.assertEqual(lines[-1], 'END')
+
+    def test_cif_values(self):
+        n, lines = self.cif(self.fnam)
+        self.assertEqual(lines[0], 'data_B')
+        atoms = self.atoms(lines)
+        self.assertEqual(n, len(atoms))
+        xyz = self.block('b_atom_xyz')
+        for i, s in enumerate(atoms):
+            w = s.split()
+            self.assertEqual(int(w[1]), i+1)
+            self.assertEqual(w[3], ['N', 'CA', 'C', 'O'][i % 4])
+            self.assertEqual(w[9:12], ['%.3f' % float32(v) for v in xyz[3*i:3*i+3]])
+            self.assertEqual(w[12], '1.00')
+        self.assertEqual(lines[-1], '#')
+
+    def test_rounding_matches_printf(self):
+        random.seed(4)
+        xyz = [float32(random.uniform(-999, 9999)) for i in range(24)]
+        xyz[:6] = [0.0005, -0.0005, 1.0625, -2.0625, 0.125, -0.0]
+        blocks = [(n, t, xyz if n == 'a_atom_xyz' else d) for n, t, d in odbfiles.molecule('a')]
+        n, lines = self.pdb(dict((n, d) for n, t, d in blocks), 'a')
+        text = [s[30+8*k:38+8*k] for s in self.atoms(lines) for k in range(3)]
+        self.assertEqual(text, ['%8.3f' % float32(v) for v in xyz])
+
+    def test_out_of_range(self):
+        blocks = odbfiles.molecule('a')
+        xyz = list(self.block('a_atom_xyz', blocks))
+        xyz[:6] = [12345.678, -1234.5678, 3.4e38, -1e20, float('nan'), 1.0]
+        b = [1e6] + [-1e6] + [20.0] * 6
+        blocks = [(n, t, xyz if n == 'a_atom_xyz' else b if n == 'a_atom_b' else d)
+                  for n, t, d in blocks]
+        fnam = self.write('big.o', odbfiles.binary(blocks))
+        n, lines = self.pdb(fnam, 'a')
+        atoms = self.atoms(lines)
+        for s in atoms:
+            self.assertEqual(len(s), 78)
+        self.assertEqual(atoms[0][30:54], '9999.999-999.9999999.999')
+        self.assertEqual(atoms[1][30:54], '-999.999     nan   1.000')
+        self.assertEqual(atoms[0][60:66], '999.99')
+        self.assertEqual(atoms[1][60:66], '-99.99')
+
+        n, lines = self.cif(fnam, 'a')
+        w = [s.split() for s in self.atoms(lines)]
+        self.assertEqual(w[0][9:12], ['12345.678', '-1234.568', '%.3f' % float32(3.4e38)])
+        self.assertEqual(w[1][9:12], ['%.3f' % float32(-1e20), 'nan', '1.000'])
+        self.assertEqual(w[0][13], '1000000.00')
+
+    def test_formatted(self):
+        binary = self.pdb(self.fnam)
+        fnam = self.write('db.fo', odbfiles.formatted(self.blocks))
+        self.assertEqual(self.pdb(fnam), binary)
+        # the datablocks of molecule a are skipped, not read
+        self.assertEqual(self.pdb(fnam, 'a')[0], 8)
+
+    def test_from_get(self):
+        self.assertEqual(self.pdb(odbparser.get(self.fnam)), self.pdb(self.fnam))
+        self.assertEqual(self.cif(odbparser.get(self.fnam)), self.cif(self.fnam))
+
+    def test_errors(self):
+        with self.assertRaises(KeyError):
+            self.pdb(self.fnam, 'c')
+        blocks = [(n, t, d[:-1] if n == 'a_residue_pointers' else d)
+                  for n, t, d in odbfiles.molecule('a')]
+        with self.assertRaises(KeyError):
+            self.pdb(self.write('bad.o', odbfiles.binary(blocks)), 'a')
+        with self.assertRaises(ValueError):
+            self.pdb(dict((n, d) for n, t, d in blocks), 'a')
+
+
+if __name__ == '__main__':
+    unittest.main()
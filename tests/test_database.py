@@ -0,0 +1,122 @@
+import os
+import unittest
+
+import odbparser
+import odbfiles
+
+
+class DatabaseTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard()
+        self.fnam = self.write('db.o', odbfiles.binary(self.blocks))
+        self.db = odbparser.Database(self.fnam)
+
+    def rewrite(self, blocks, contents=None):
+        """Write the file again, with a later modification time."""
+        st = os.stat(self.fnam)
+        with open(self.fnam, 'wb') as f:
+            f.write(contents if contents is not None else odbfiles.binary(blocks))
+        os.utime(self.fnam, ns=(st.st_atime_ns, st.st_mtime_ns + 10**9))
+
+    def replace(self, blocks, name, data):
+        return [(n, t, data if n == name else d) for n, t, d in blocks]
+
+    def test_read(self):
+        self.assertEqual(self.db.filename, self.fnam)
+        self.assertEqual(len(self.db), len(self.blocks))
+        self.assertBlocksEqual(self.db.blocks, self.blocks)
+
+    def test_unchanged(self):
+        xyz = self.db['a_atom_xyz']
+        self.assertEqual(self.db.refresh(), ([], []))
+        self.rewrite(self.blocks)
+        self.assertEqual(self.db.refresh(), ([], []))
+        self.assertIs(self.db['a_atom_xyz'], xyz)
+
+    def test_untouched_file_is_not_read(self):
+        st = os.stat(self.fnam)
+        with open(self.fnam, 'r+b') as f:
+            f.write(b'\0' * 8)		# breaks the first header
+        os.utime(self.fnam, ns=(st.st_atime_ns, st.st_mtime_ns))
+        self.assertEqual(self.db.refresh(), ([], []))
+
+    def test_changed_in_place(self):
+        xyz = self.db['a_atom_xyz']
+        data = [v + 1 for v in self.blocks[4][2]]
+        blocks = self.replace(self.blocks, 'a_atom_xyz', data)
+        self.rewrite(blocks)
+        self.assertEqual(self.db.refresh(), (['a_atom_xyz'], []))
+        self.assertIs(self.db['a_atom_xyz'], xyz)
+        self.assertBlocksEqual(self.db.blocks, blocks)
+
+    def test_resized(self):
+        blocks = self.replace(self.blocks, '.sam_integer', [7, 8, 9])
+        self.rewrite(blocks)
+        changed, removed = self.db.refresh()
+        # the blocks after it have moved, but are not read again
+        self.assertEqual(changed, ['.sam_integer'])
+        self.assertEqual(removed, [])
+        self.assertBlocksEqual(self.db.blocks, blocks)
+        self.assertEqual(self.db.blockinfo('.sam_integer')[:2], ('I', 3))
+
+    def test_added_and_removed(self):
+        blocks = self.blocks[1:] + [('.new', 'I', [1])]
+        self.rewrite(blocks)
+        self.assertEqual(self.db.refresh(), (['.new'], ['.gs_real']))
+        self.assertBlocksEqual(self.db.blocks, blocks)
+        with self.assertRaises(KeyError):
+            self.db.blockinfo('.gs_real')
+
+    def test_replaced_by_rename(self):
+        blocks = self.replace(self.blocks, '.names', [b'XYZ', b'DEF', b'GHI'])
+        new = self.write('new.o', odbfiles.binary(blocks))
+        os.rename(new, self.fnam)
+        self.assertEqual(self.db.refresh(), (['.names'], []))
+        self.assertBlocksEqual(self.db.blocks, blocks)
+
+    def assertUnchangedAfterError(self, contents):
+        xyz = self.db['a_atom_xyz'].copy()
+        self.rewrite(None, contents)
+        with self.assertRaises(odbparser.error):
+            self.db.refresh()
+        self.assertBlocksEqual(self.db.blocks, self.blocks)
+        self.assertEqual(list(self.db['a_atom_xyz']), list(xyz))
+
+    def test_truncated(self):
+        changed = self.replace(self.blocks, 'a_atom_xyz', [0.0] * 24)
+        contents = odbfiles.binary(changed)
+        self.assertUnchangedAfterError(contents[:len(contents) - 10])
+
+    def test_truncated_header(self):
+        contents = odbfiles.binary(self.blocks)
+        self.assertUnchangedAfterError(contents + odbfiles.header('.x', 'I', 1)[:20])
+
+    def test_broken_marker(self):
+        contents = bytearray(odbfiles.binary(self.blocks))
+        contents[38 + 4 + 28*4] ^= 1		# trailing marker of .gs_real
+        self.assertUnchangedAfterError(bytes(contents))
+
+    def test_retry_after_error(self):
+        contents = odbfiles.binary(self.blocks)
+        self.rewrite(None, contents[:-3])
+        self.assertRaises(odbparser.error, self.db.refresh)
+        blocks = self.replace(self.blocks, '.sam_integer', [5, 4, 3, 2, 1])
+        self.rewrite(blocks)
+        self.assertEqual(self.db.refresh(), (['.sam_integer'], []))
+
+    def test_end_header(self):
+        contents = odbfiles.binary(self.blocks) + odbfiles.header('', ' ', 0)
+        self.rewrite(None, contents + b'trailing rubbish')
+        self.assertEqual(self.db.refresh(), ([], []))
+
+    def test_formatted(self):
+        fnam = self.write('db.fo', odbfiles.formatted(self.blocks))
+        db = odbparser.Database(fnam)
+        self.assertBlocksEqual(db.blocks, self.blocks, places=5)
+        self.assertEqual(db.refresh(), ([], []))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,118 @@
+import unittest
+
+import odbparser
+import odbfiles
+
+
+def stripped(text):
+    """Strip trailing spaces from every line, as editors do."""
+    return ''.join(s.rstrip() + '\n' for s in text.splitlines())
+
+
+class DiffTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard()
+        self.a = self.write('a.o', odbfiles.binary(self.blocks))
+
+    def replace(self, name, data, blocks=None):
+        return [(n, t, data if n == name else d) for n, t, d in blocks or self.blocks]
+
+    def test_same(self):
+        self.assertEqual(odbparser.diff(self.a, self.a), ([], [], {}))
+        b = self.write('b.fo', odbfiles.formatted(self.blocks))
+        self.assertEqual(odbparser.diff(self.a, b, atol=1e-6), ([], [], {}))
+        self.assertEqual(odbparser.diff(b, self.a, atol=1e-6), ([], [], {}))
+
+    def test_changed(self):
+        xyz = list(self.blocks[4][2])
+        xyz[0] += 1
+        xyz[5] += 0.001
+        blocks = self.replace('a_atom_xyz', xyz)
+        blocks = self.replace('.names', [b'ABC', b'XYZ', b'GHI'], blocks)
+        blocks = self.replace('.help_text', ['hello world', 'other line', 'third'], blocks)
+        blocks = self.replace('.sam_integer', [1, 2, 3, -4, 5, 6, 7], blocks)
+        b = self.write('b.o', odbfiles.binary(blocks))
+        added, removed, changed = odbparser.diff(self.a, b)
+        self.assertEqual((added, removed), ([], []))
+        self.assertEqual(changed, {'a_atom_xyz': 2, '.names': 1, '.help_text': 2,
+                                   '.sam_integer': 2})
+
+    def test_tolerance(self):
+        xyz = list(self.blocks[4][2])
+        xyz[0] += 1
+        xyz[5] += 0.001
+        xyz[7] *= 1.01
+        b = self.write('b.o', odbfiles.binary(self.replace('a_atom_xyz', xyz)))
+        self.assertEqual(odbparser.diff(self.a, b)[2], {'a_atom_xyz': 3})
+        self.assertEqual(odbparser.diff(self.a, b, atol=0.01)[2], {'a_atom_xyz': 2})
+        self.assertEqual(odbparser.diff(self.a, b, atol=0.01, rtol=0.02)[2], {'a_atom_xyz': 1})
+        self.assertEqual(odbparser.diff(self.a, b, atol=2)[2], {})
+        ints = self.replace('.sam_integer', [1, 2, 4, -4, 50])
+        b = self.write('c.o', odbfiles.binary(ints))
+        self.assertEqual(odbparser.diff(self.a, b)[2], {'.sam_integer': 2})
+        self.assertEqual(odbparser.diff(self.a, b, atol=1)[2], {'.sam_integer': 1})
+
+    def test_nan(self):
+        reals = [float('nan'), 1.0, float('inf')]
+        a = self.write('n.o', odbfiles.binary([('.r', 'R', reals)]))
+        b = self.write('m.o', odbfiles.binary([('.r', 'R', [float('nan'), 2.0, float('inf')])]))
+        self.assertEqual(odbparser.diff(a, a)[2], {})
+        self.assertEqual(odbparser.diff(a, b, atol=1e9)[2], {})
+        self.assertEqual(odbparser.diff(a, b)[2], {'.r': 1})
+
+    def test_added_removed(self):
+        blocks = self.blocks[1:] + [('.new', 'I', [1])]
+        b = self.write('b.o', odbfiles.binary(blocks))
+        self.assertEqual(odbparser.diff(self.a, b), (['.new'], ['.gs_real'], {}))
+        self.assertEqual(odbparser.diff(b, self.a), (['.gs_real'], ['.new'], {}))
+
+    def test_type_changed(self):
+        b = self.write('b.o', odbfiles.binary([('.sam_integer', 'R', [1.0, 2.0])
+                                               if n == '.sam_integer' else (n, t, d)
+                                               for n, t, d in self.blocks]))
+        self.assertEqual(odbparser.diff(self.a, b)[2], {'.sam_integer': 5})
+
+    def test_large_c_blocks(self):
+        # C datablocks of several chunks, in files whose lines have
+        # lost their trailing spaces, and so end early
+        names = [('N%d' % (i % 997)).encode() for i in range(150007)]
+        other = list(names)
+        for i in (0, 65529, 65530, 65531, 131059, 131060, 150006):
+            other[i] = b'XX'
+        blocks = [('.names', 'C', names), ('.after', 'I', [1, 2, 3])]
+        changed = [('.names', 'C', other), ('.after', 'I', [1, 2, 3])]
+        a = self.write('a.o', odbfiles.binary(blocks))
+        fa = self.write('a.fo', stripped(odbfiles.formatted(blocks)))
+        fb = self.write('b.fo', stripped(odbfiles.formatted(changed)))
+        self.assertEqual(list(odbparser.get(fa)['.names']),
+                         [s.decode() for s in names])
+        self.assertEqual(odbparser.diff(a, fa), ([], [], {}))
+        self.assertEqual(odbparser.diff(fa, a), ([], [], {}))
+        self.assertEqual(odbparser.diff(a, fb)[2], {'.names': 7})
+        self.assertEqual(odbparser.diff(fa, fb)[2], {'.names': 7})
+
+    def test_short_lines(self):
+        # one name per line in one file, ten in the other
+        names = [('AB%d' % i).encode() for i in range(25)]
+        text = '.NAMES                    C         25 (1x,a6)\n'
+        text += ''.join(' %s\n' % s.decode() for s in names)
+        text += '.AFTER                    I          2 (6(1x,i11))\n 1 2\n'
+        one = self.write('one.fo', text)
+        ten = self.write('ten.fo', stripped(odbfiles.formatted(
+            [('.names', 'C', names), ('.after', 'I', [1, 2])])))
+        self.assertEqual(odbparser.get(one)['.names'], tuple(s.decode() for s in names))
+        self.assertEqual(odbparser.diff(one, ten), ([], [], {}))
+
+    def test_errors(self):
+        with self.assertRaises(OSError):
+            odbparser.diff(self.a, self.path('missing.o'))
+        contents = odbfiles.binary(self.blocks)
+        b = self.write('b.o', contents[:-20])
+        with self.assertRaises(IOError):
+            odbparser.diff(self.a, b)
+
+
+if __name__ == '__main__':
+    unittest.main()
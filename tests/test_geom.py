@@ -0,0 +1,139 @@
+import math
+import unittest
+
+import numpy
+
+import odbparser
+import odbfiles
+
+
+def rotation(seed):
+    """A random rotation, from the QR decomposition of a random matrix."""
+    q, r = numpy.linalg.qr(numpy.random.RandomState(seed).normal(size=(3, 3)))
+    q *= numpy.sign(numpy.diag(r))
+    if numpy.linalg.det(q) < 0:
+        q[:, 0] = -q[:, 0]
+    return q
+
+
+def matrix(rot, shift):
+    """The 16 elements of a column major 4x4 matrix, as in .gs_real[4:20]."""
+    m = numpy.identity(4)
+    m[:3, :3] = rot
+    m[:3, 3] = shift
+    return list(m.T.ravel())
+
+
+def reference_transform(xyz, mat):
+    m = numpy.array(mat, dtype=numpy.float64).reshape(4, 4).T
+    p = numpy.asarray(xyz, dtype=numpy.float64).reshape(-1, 3)
+    return (p @ m[:3, :3].T + m[:3, 3]).ravel()
+
+
+def reference_rmsd(a, b):
+    """Kabsch, by way of the singular value decomposition."""
+    a = numpy.asarray(a, dtype=numpy.float64).reshape(-1, 3)
+    b = numpy.asarray(b, dtype=numpy.float64).reshape(-1, 3)
+    a = a - a.mean(axis=0)
+    b = b - b.mean(axis=0)
+    u, s, vt = numpy.linalg.svd(b.T @ a)
+    d = numpy.sign(numpy.linalg.det(u @ vt))
+    r = u @ numpy.diag([1, 1, d]) @ vt
+    return math.sqrt(((a @ r.T - b) ** 2).sum() / len(a))
+
+
+class GeomTest(odbfiles.TestCase):
+
+    def points(self, n, seed=1):
+        return numpy.random.RandomState(seed).uniform(-50, 80, 3*n).astype(numpy.float32)
+
+    def test_transform(self):
+        mat = matrix(rotation(1), [10, -20, 3.5])
+        # every remainder of the four points done at a time
+        for n in list(range(10)) + [1027]:
+            xyz = self.points(n)
+            want = reference_transform(xyz, mat)
+            got = odbparser.transform(xyz.copy(), mat)
+            self.assertEqual(got.dtype, numpy.float32)
+            numpy.testing.assert_allclose(got, want, rtol=0, atol=1e-4)
+
+    def test_transform_in_place(self):
+        xyz = self.points(5)
+        before = xyz.copy()
+        self.assertIs(odbparser.transform(xyz, [1, 0, 0, 0, 0, 1, 0, 0,
+                                                 0, 0, 1, 0, 1, 2, 3, 1]), xyz)
+        self.assertEqual(xyz.tolist(), (before + numpy.tile(numpy.float32([1, 2, 3]), 5)).tolist())
+        with self.assertRaises(TypeError):
+            odbparser.transform(before.astype(numpy.float64), [0] * 16)
+        with self.assertRaises(TypeError):
+            odbparser.transform(before[::2], [0] * 16)
+        with self.assertRaises(ValueError):
+            odbparser.transform(before[:4], [0] * 16)
+        with self.assertRaises(ValueError):
+            odbparser.transform(before, [0] * 15)
+
+    def test_extent(self):
+        for n in list(range(1, 10)) + [1024, 1025, 5000]:
+            xyz = self.points(n, seed=n)
+            p = xyz.astype(numpy.float64).reshape(-1, 3)
+            c = odbparser.centroid(xyz)
+            numpy.testing.assert_allclose(c, p.mean(axis=0), rtol=0, atol=1e-4)
+            lo, hi = odbparser.bbox(xyz)
+            self.assertEqual(list(lo), list(p.min(axis=0)))
+            self.assertEqual(list(hi), list(p.max(axis=0)))
+        # the extremes are in the scalar tail
+        xyz = numpy.zeros(3*5, dtype=numpy.float32)
+        xyz[-3:] = [-1, 2, -3]
+        self.assertEqual(odbparser.bbox(xyz), ((-1, 0, -3), (0, 2, 0)))
+        self.assertEqual(odbparser.centroid([]), (0, 0, 0))
+        self.assertEqual(odbparser.bbox([]), ((0, 0, 0), (0, 0, 0)))
+
+    def test_centroid_accuracy(self):
+        # single precision sums would drift far from the mean here
+        xyz = numpy.full(3*300000, 1000.1, dtype=numpy.float32)
+        self.assertEqual(odbparser.centroid(xyz), (float(xyz[0]),) * 3)
+
+    def test_rmsd(self):
+        for n, seed in ((3, 1), (10, 2), (200, 3)):
+            a = self.points(n, seed)
+            noise = numpy.random.RandomState(seed).normal(scale=0.5, size=3*n)
+            b = reference_transform(a, matrix(rotation(seed), [5, 6, 7])) + noise
+            b = b.astype(numpy.float32)
+            self.assertAlmostEqual(odbparser.rmsd(a, b), reference_rmsd(a, b), places=7)
+            plain = math.sqrt(((a - b) ** 2).sum() / n)
+            self.assertAlmostEqual(odbparser.rmsd(a, b, fit=False), plain, places=3)
+
+    def test_rmsd_superposed(self):
+        a = self.points(50)
+        b = reference_transform(a, matrix(rotation(7), [1, 2, 3]))
+        self.assertLess(odbparser.rmsd(a, b), 1e-3)
+        # a mirror image can not be superposed by a rotation
+        m = a.reshape(-1, 3) * [1, 1, -1]
+        self.assertAlmostEqual(odbparser.rmsd(a, m), reference_rmsd(a, m), places=4)
+        self.assertGreater(odbparser.rmsd(a, m), 1)
+        with self.assertRaises(ValueError):
+            odbparser.rmsd(a, a[:-3])
+
+    def test_rmsd_planar(self):
+        # a ring of six atoms, whose smallest singular value is 0
+        t = numpy.arange(6) * math.pi / 3
+        ring = numpy.stack([1.4 * numpy.cos(t), 1.4 * numpy.sin(t), 0 * t], axis=1) + 30
+        a = ring.astype(numpy.float32).ravel()
+        noise = numpy.random.RandomState(5).normal(scale=0.05, size=18)
+        b = (reference_transform(a, matrix(rotation(5), [1, 2, 3])) + noise).astype(numpy.float32)
+        self.assertAlmostEqual(odbparser.rmsd(a, b), reference_rmsd(a, b), places=7)
+
+    def test_get_transform(self):
+        blocks = odbfiles.standard()
+        fnam = self.write('db.o', odbfiles.binary(blocks))
+        mat = matrix(rotation(2), [1, 2, 3])
+        xyz = dict((n, d) for n, t, d in blocks)['a_atom_xyz']
+        db = odbparser.get(fnam, transform=mat)
+        numpy.testing.assert_allclose(db['a_atom_xyz'], reference_transform(xyz, mat),
+                                      rtol=0, atol=1e-4)
+        # other real datablocks are left alone
+        self.assertEqual(db['.gs_real'].tolist(), odbparser.get(fnam)['.gs_real'].tolist())
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,94 @@
+import os
+import struct
+import unittest
+
+import odbparser
+import odbfiles
+
+
+# gfortran's longest subrecord
+MAXSUB = 2**31 - 9
+
+
+class SplitRecordTest(odbfiles.TestCase):
+
+    def test_get(self):
+        blocks = odbfiles.standard()
+        for parts in (2, 3, 7):
+            fnam = self.write('split.o', odbfiles.binary(blocks, parts=parts))
+            self.assertBlocksEqual(odbparser.get(fnam), blocks)
+            self.assertBlocksEqual(odbparser.get(fnam, numpy=False), blocks)
+
+    def test_slice(self):
+        blocks = [('.ints', 'I', list(range(1000)))]
+        fnam = self.write('split.o', odbfiles.binary(blocks, parts=3))
+        # the cuts fall inside elements 333 and 666
+        for start, stop in ((0, 1000), (330, 340), (333, 334), (660, 670), (100, 900)):
+            self.assertEqual(odbparser.read_slice(fnam, '.ints', start, stop).tolist(),
+                             list(range(start, stop)))
+
+    def test_database(self):
+        blocks = odbfiles.standard()
+        fnam = self.write('split.o', odbfiles.binary(blocks, parts=3))
+        self.assertBlocksEqual(odbparser.Database(fnam).blocks, blocks)
+
+    def test_broken_marker(self):
+        blocks = [('.ints', 'I', list(range(100)))]
+        contents = bytearray(odbfiles.binary(blocks, parts=2))
+        # the leading marker of the second subrecord
+        contents[38 + 4 + 200 + 4] ^= 0x40
+        fnam = self.write('bad.o', bytes(contents))
+        with self.assertRaises(odbparser.error):
+            odbparser.get(fnam, verify=True)
+        with self.assertRaises(odbparser.error):
+            odbparser.Database(fnam)
+
+
+class LargeRecordTest(odbfiles.TestCase):
+    """A datablock of more than 2 GB, in a sparse file."""
+
+    def setUp(self):
+        super().setUp()
+        self.n = 2**29 + 16				# 64 bytes over 2 GB
+        nbytes = 4 * self.n
+        self.fnam = self.path('large.o')
+        # the element holding the last bytes of the first subrecord
+        self.cut = MAXSUB // 4
+        self.values = dict((i, float(i % 1000) + 0.5)
+                           for i in range(self.cut - 4, self.cut + 5))
+        self.values[0] = 1.5
+        self.values[self.n - 1] = -2.5
+        data = b''.join(struct.pack('>f', self.values[i]) for i in range(self.cut - 4, self.cut + 5))
+        start = 4 * (self.cut - 4)
+        with open(self.fnam, 'wb') as f:
+            f.write(odbfiles.header('.big', 'R', self.n))
+            base = f.tell()
+            f.write(struct.pack('>i', -MAXSUB))
+            f.write(struct.pack('>f', 1.5))
+            # the payload is zero, apart from the elements around the cut
+            f.seek(base + 4 + start)
+            f.write(data[:MAXSUB - start])
+            f.write(struct.pack('>ii', MAXSUB, nbytes - MAXSUB))
+            f.write(data[MAXSUB - start:])
+            f.seek(base + 4 + MAXSUB + 8 + nbytes - MAXSUB - 4)
+            f.write(struct.pack('>f', -2.5))
+            f.write(struct.pack('>i', -(nbytes - MAXSUB)))
+            f.write(odbfiles.header('.after', 'I', 3) + odbfiles.record(struct.pack('>3i', 7, 8, 9)))
+        st = os.stat(self.fnam)
+        if st.st_blocks * 512 > 2**30:
+            self.skipTest('the file system does not support sparse files')
+
+    def test_slice_across_subrecords(self):
+        for start in range(self.cut - 4, self.cut + 1):
+            got = odbparser.read_slice(self.fnam, '.big', start, start + 4)
+            self.assertEqual(got.tolist(), [self.values[i] for i in range(start, start + 4)])
+        self.assertEqual(odbparser.read_slice(self.fnam, '.big', 0, 2).tolist(), [1.5, 0])
+        self.assertEqual(odbparser.read_slice(self.fnam, '.big', -2, self.n).tolist(), [0, -2.5])
+
+    def test_after(self):
+        # the datablock after the large one is found past both subrecords
+        self.assertEqual(odbparser.read_slice(self.fnam, '.after', 0, 3).tolist(), [7, 8, 9])
+
+
+if __name__ == '__main__':
+    unittest.main()
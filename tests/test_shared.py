@@ -0,0 +1,222 @@
+import multiprocessing
+import os
+import struct
+import unittest
+
+import numpy
+
+import odbparser
+import odbfiles
+
+
+SHM = '/dev/shm'
+PREFIX = 'odbparser.%d.' % os.getuid()
+
+
+def segments():
+    return set(f for f in os.listdir(SHM) if f.startswith(PREFIX))
+
+
+def checksum(fnam, rounds):
+    """Read the file through the cache 'rounds' times, and return the
+    sums of its coordinates."""
+    sums = []
+    for i in range(rounds):
+        db = odbparser.get(fnam, shared=True)
+        sums.append(float(db['m_atom_xyz'].astype(numpy.float64).sum()))
+    return sums
+
+
+@unittest.skipUnless(os.path.isdir(SHM), 'no /dev/shm')
+class SharedTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        before = segments()
+        self.addCleanup(self.cleanup, before)
+        self.blocks = odbfiles.standard() + odbfiles.molecule('m', natoms=4000)
+        self.fnam = self.write('db.o', odbfiles.binary(self.blocks))
+
+    def cleanup(self, before):
+        odbparser.unlink_shared(self.fnam)
+        for f in segments() - before:
+            os.unlink(os.path.join(SHM, f))
+
+    def new(self):
+        """Segments made by this test, apart from their lock objects."""
+        return [f for f in segments() if not f.endswith('.lock')]
+
+    def rewrite(self, blocks):
+        st = os.stat(self.fnam)
+        with open(self.fnam, 'wb') as f:
+            f.write(odbfiles.binary(blocks))
+        os.utime(self.fnam, ns=(st.st_atime_ns, st.st_mtime_ns + 10**9))
+
+    def changed(self, seed):
+        return odbfiles.standard() + odbfiles.molecule('m', natoms=4000, seed=seed)
+
+    def test_same_as_get(self):
+        before = len(self.new())
+        db = odbparser.get(self.fnam, shared=True)
+        self.assertBlocksEqual(db, self.blocks)
+        self.assertFalse(db['a_atom_xyz'].flags.writeable)
+        again = odbparser.get(self.fnam, shared=True)
+        self.assertBlocksEqual(again, self.blocks)
+        self.assertEqual(len(self.new()), before + 1)
+
+    def test_relative_path(self):
+        before = len(self.new())
+        odbparser.get(self.fnam, shared=True)
+        cwd = os.getcwd()
+        os.chdir(self.tmp.name)
+        try:
+            self.assertBlocksEqual(odbparser.get('db.o', shared=True), self.blocks)
+        finally:
+            os.chdir(cwd)
+        self.assertEqual(len(self.new()), before + 1)
+
+    def test_changed(self):
+        old = odbparser.get(self.fnam, shared=True)
+        xyz = old['m_atom_xyz'].copy()
+        blocks = self.changed(2)
+        self.rewrite(blocks)
+        self.assertBlocksEqual(odbparser.get(self.fnam, shared=True), blocks)
+        # the old mapping is still there
+        self.assertEqual(old['m_atom_xyz'].tolist(), xyz.tolist())
+
+    def test_replaced_by_rename(self):
+        before = len(self.new())
+        odbparser.get(self.fnam, shared=True)
+        for seed in (3, 4, 5):
+            blocks = self.changed(seed)
+            new = self.write('new.o', odbfiles.binary(blocks))
+            os.rename(new, self.fnam)
+            self.assertBlocksEqual(odbparser.get(self.fnam, shared=True), blocks)
+        # the segments of the replaced files are gone
+        self.assertEqual(len(self.new()), before + 1)
+
+    def test_unlink(self):
+        before = segments()
+        odbparser.get(self.fnam, shared=True)
+        self.assertEqual(len(segments() - before), 2)
+        odbparser.unlink_shared(self.fnam)
+        # the lock object goes with the segment
+        self.assertEqual(segments(), before)
+        odbparser.unlink_shared(self.fnam)
+        odbparser.unlink_shared(self.path('missing.o'))
+        self.assertEqual(segments(), before)
+
+    def test_failed(self):
+        # a file that cannot be decoded leaves nothing behind
+        before = segments()
+        bad = self.write('bad.fo', '.TEXT                     T          5         72\nabc\n')
+        self.addCleanup(odbparser.unlink_shared, bad)
+        odbparser.get(bad, shared=True)
+        self.assertEqual(segments(), before)
+
+    def made(self):
+        """Read the file through the cache, and return the path of the
+        segment made for it, and of its lock object."""
+        before = segments()
+        odbparser.get(self.fnam, shared=True)
+        new = segments() - before
+        seg = [f for f in new if not f.endswith('.lock')][0]
+        return os.path.join(SHM, seg), os.path.join(SHM, seg + '.lock')
+
+    def forge(self, seg, offset, fmt, value):
+        with open(seg, 'r+b') as f:
+            f.seek(offset)
+            f.write(struct.pack(fmt, value))
+
+    def test_forged(self):
+        # a segment whose table of datablocks does not add up is not
+        # used, but made again. The header is 72 bytes, and each entry
+        # of the table 56: name, type, pad, reclen, size, offset, nbytes
+        entry = 72 + 56 * 2
+        forgeries = [(12, '=i', 10**6),			# nblocks
+                     (12, '=i', -1),
+                     (entry + 40, '=q', 2**40),		# offset
+                     (entry + 40, '=q', 64 * 3),		# inside the table
+                     (entry + 40, '=q', 4096 + 4),		# unaligned
+                     (entry + 32, '=q', 10**6),		# size
+                     (entry + 48, '=q', 4),		# nbytes
+                     (entry + 26, '=c', b'X'),		# type
+                     (entry + 28, '=i', 2)]		# reclen
+        for offset, fmt, value in forgeries:
+            seg, lock = self.made()
+            self.forge(seg, offset, fmt, value)
+            db = odbparser.get(self.fnam, shared=True)
+            self.assertBlocksEqual(db, self.blocks)
+            self.assertFalse(db['a_atom_xyz'].flags.writeable)
+            odbparser.unlink_shared(self.fnam)
+
+    def test_access(self):
+        # objects others can use are not trusted
+        seg, lock = self.made()
+        os.chmod(seg, 0o644)
+        self.assertBlocksEqual(odbparser.get(self.fnam, shared=True), self.blocks)
+        self.assertEqual(os.stat(seg).st_mode & 0o777, 0o600)
+        os.chmod(lock, 0o666)
+        db = odbparser.get(self.fnam, shared=True)
+        self.assertBlocksEqual(db, self.blocks)
+        # read from the file, since the lock cannot be trusted
+        self.assertTrue(db['a_atom_xyz'].flags.writeable)
+        os.chmod(lock, 0o600)
+
+    @unittest.skipUnless(hasattr(os, 'geteuid') and os.geteuid() == 0, 'needs root')
+    def test_owner(self):
+        seg, lock = self.made()
+        os.chown(seg, 12345, -1)
+        db = odbparser.get(self.fnam, shared=True)
+        self.assertBlocksEqual(db, self.blocks)
+        self.assertEqual(os.stat(seg).st_uid, 0)
+        os.chown(lock, 12345, -1)
+        db = odbparser.get(self.fnam, shared=True)
+        self.assertTrue(db['a_atom_xyz'].flags.writeable)
+        os.chown(lock, 0, -1)
+
+    def test_processes(self):
+        ctx = multiprocessing.get_context('spawn')
+        want = float(numpy.array(self.blocks[11][2], dtype=numpy.float32)
+                     .astype(numpy.float64).sum())
+        with ctx.Pool(6) as pool:
+            for round in range(3):
+                odbparser.unlink_shared(self.fnam)
+                results = pool.starmap(checksum, [(self.fnam, 5)] * 12)
+                self.assertEqual(results, [[want] * 5] * 12)
+
+    def test_processes_while_unlinking(self):
+        # the lock object is removed under processes waiting for it
+        ctx = multiprocessing.get_context('spawn')
+        want = float(numpy.array(self.blocks[11][2], dtype=numpy.float32)
+                     .astype(numpy.float64).sum())
+        before = segments()
+        with ctx.Pool(6) as pool:
+            result = pool.starmap_async(checksum, [(self.fnam, 40)] * 6)
+            while not result.ready():
+                odbparser.unlink_shared(self.fnam)
+            self.assertEqual(result.get(timeout=60), [[want] * 40] * 6)
+        odbparser.unlink_shared(self.fnam)
+        self.assertEqual(segments(), before)
+
+    def test_processes_while_changing(self):
+        # readers racing with changes see one version or another, never
+        # a mixture, and the segments do not pile up. The file is
+        # replaced by rename, since a reader that falls back to reading
+        # the file itself could see it half written in place.
+        ctx = multiprocessing.get_context('spawn')
+        versions = [self.blocks] + [self.changed(seed) for seed in (6, 7, 8)]
+        sums = set(float(numpy.array(b[11][2], dtype=numpy.float32)
+                         .astype(numpy.float64).sum()) for b in versions)
+        before = len(self.new())
+        with ctx.Pool(6) as pool:
+            result = pool.starmap_async(checksum, [(self.fnam, 40)] * 6)
+            for blocks in versions[1:]:
+                os.rename(self.write('new.o', odbfiles.binary(blocks)), self.fnam)
+            for sums_seen in result.get(timeout=60):
+                self.assertTrue(set(sums_seen) <= sums)
+        self.assertLessEqual(len(self.new()), before + 1)
+
+
+if __name__ == '__main__':
+    unittest.main()
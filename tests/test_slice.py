@@ -0,0 +1,93 @@
+import unittest
+
+import odbparser
+import odbfiles
+
+
+RANGES = [(0, 0), (0, 1), (0, 5), (3, 17), (9, 11), (10, 40), (-3, 1000), (-1000, 2),
+          (5, 3), (-5, -2), (2, -2), (100, 200), (-1, -1)]
+
+
+class SliceTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = [
+            ('.ints', 'I', [i * 3 - 20 for i in range(23)]),
+            ('.reals', 'R', [i / 3.0 for i in range(31)]),
+            ('.names', 'C', [('N%d' % i).encode() for i in range(27)]),
+            ('.text', 'T', ['line %d' % i for i in range(12)]),
+        ] + odbfiles.molecule('m', natoms=24)
+        self.binary = self.write('db.o', odbfiles.binary(self.blocks))
+        self.formatted = self.write('db.fo', odbfiles.formatted(self.blocks))
+
+    def check(self, fnam, name, per=1, **kwds):
+        whole = odbparser.get(fnam, **kwds)[name]
+        for start, stop in RANGES:
+            got = odbparser.read_slice(fnam, name, start, stop, **kwds)
+            want = list(whole)[start * per:stop * per]
+            self.assertEqual(list(got), want, (fnam, name, start, stop))
+
+    def test_binary(self):
+        for name in ('.ints', '.reals', '.names', '.text', 'm_residue_pointers'):
+            self.check(self.binary, name)
+
+    def test_formatted(self):
+        for name in ('.ints', '.reals', '.names', '.text', 'm_residue_pointers'):
+            self.check(self.formatted, name)
+
+    def test_xyz(self):
+        # the elements of a coordinate datablock are atoms
+        for fnam in (self.binary, self.formatted):
+            self.check(fnam, 'm_atom_xyz', per=3)
+            xyz = odbparser.read_slice(fnam, 'm_atom_xyz', 10, 12)
+            self.assertEqual(len(xyz), 6)
+
+    def test_without_numpy(self):
+        got = odbparser.read_slice(self.binary, '.reals', 2, 5, numpy=False)
+        self.assertIsInstance(got, odbparser.Array)
+        self.check(self.binary, '.ints', numpy=False)
+
+    def test_same_as_formatted(self):
+        for name in ('.ints', '.names', '.text'):
+            for start, stop in RANGES:
+                b = odbparser.read_slice(self.binary, name, start, stop)
+                f = odbparser.read_slice(self.formatted, name, start, stop)
+                b = [s.decode() if isinstance(s, bytes) else s for s in b]
+                f = [s.decode() if isinstance(s, bytes) else s for s in f]
+                self.assertEqual(list(b), list(f))
+
+    def test_written(self):
+        # a file written by put_formatted, with list-directed reals
+        fnam = self.path('put.fo')
+        odbparser.put_formatted(fnam, dict((n, (t, d)) for n, t, d in self.blocks))
+        for name in ('.ints', '.reals', '.names', '.text', 'm_atom_xyz'):
+            self.check(fnam, name, per=3 if name == 'm_atom_xyz' else 1)
+
+    def test_missing(self):
+        for fnam in (self.binary, self.formatted):
+            with self.assertRaises(KeyError):
+                odbparser.read_slice(fnam, '.nothing', 0, 1)
+        with self.assertRaises(KeyError):
+            odbparser.read_slice(self.binary, 'x' * 26, 0, 1)
+        with self.assertRaises(OSError):
+            odbparser.read_slice(self.path('missing.o'), '.ints', 0, 1)
+
+    def test_truncated(self):
+        contents = odbfiles.binary(self.blocks[:1])
+        fnam = self.write('short.o', contents[:-30])
+        with self.assertRaises(IOError):
+            odbparser.read_slice(fnam, '.ints', 15, 23)
+
+    def test_truncated_text(self):
+        # a formatted text datablock with fewer lines than it claims
+        text = '.TEXT                     T          5         72\nline 0\nline 1\n'
+        fnam = self.write('short.fo', text)
+        self.assertEqual(list(odbparser.read_slice(fnam, '.text', 0, 2)), ['line 0', 'line 1'])
+        for start, stop in ((0, 3), (1, 5), (2, 3)):
+            with self.assertRaisesRegex(odbparser.error, 'ends early'):
+                odbparser.read_slice(fnam, '.text', start, stop)
+
+
+if __name__ == '__main__':
+    unittest.main()
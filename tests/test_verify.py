@@ -0,0 +1,175 @@
+import os
+import struct
+import subprocess
+import sys
+import threading
+import unittest
+
+import odbparser
+import odbfiles
+
+
+def _table():
+    table = []
+    for n in range(256):
+        for i in range(8):
+            n = (n >> 1) ^ (0x82f63b78 if n & 1 else 0)
+        table.append(n)
+    return table
+
+
+TABLE = _table()
+
+
+def crc32c(data):
+    """Reference CRC32C, a byte at a time."""
+    crc = 0xffffffff
+    for b in data:
+        crc = TABLE[(crc ^ b) & 0xff] ^ (crc >> 8)
+    return crc ^ 0xffffffff
+
+
+def raw(name, typ, n, data):
+    """A datablock with a data record of any contents."""
+    return odbfiles.header(name, typ, n) + odbfiles.record(data)
+
+
+class CrcTest(odbfiles.TestCase):
+
+    def test_check_value(self):
+        fnam = self.write('check.o', raw('.t', 'T', 9, b'123456789'))
+        self.assertEqual(odbparser.verify(fnam), {'.t': 0xe3069283})
+
+    def test_lengths(self):
+        # every tail length of the wide kernels, and unaligned starts
+        data = bytes((i * 37 + 11) & 0xff for i in range(300))
+        blocks = b''.join(raw('.t%d' % n, 'T', n, data[n % 7:n % 7 + n]) for n in range(1, 70))
+        fnam = self.write('lengths.o', blocks)
+        crc = odbparser.verify(fnam)
+        for n in range(1, 70):
+            self.assertEqual(crc['.t%d' % n], crc32c(data[n % 7:n % 7 + n]), n)
+
+    def test_blocks(self):
+        blocks = odbfiles.standard()
+        fnam = self.write('db.o', odbfiles.binary(blocks))
+        crc = odbparser.verify(fnam)
+        self.assertEqual(sorted(crc), sorted(n for n, t, d in blocks))
+        for name, typ, data in blocks:
+            self.assertEqual(crc[name], crc32c(odbfiles.payload(typ, data)), name)
+        # split records give the same checksums
+        split = self.write('split.o', odbfiles.binary(blocks, parts=3))
+        self.assertEqual(odbparser.verify(split), crc)
+
+    def test_chunks(self):
+        # a datablock longer than the chunks the file is read in
+        ints = [(i * 7919) % 65536 - 30000 for i in range((1 << 20) // 4 + 1001)]
+        fnam = self.write('long.o', odbfiles.binary([('.ints', 'I', ints)], parts=2))
+        self.assertEqual(odbparser.verify(fnam)['.ints'], crc32c(odbfiles.payload('I', ints)))
+
+    def test_threads(self):
+        # the first checksums of a new process, computed on many threads
+        # at once, are all right
+        blocks = [('.t%d' % i, 'T', ['line %d' % j for j in range(i + 1)]) for i in range(20)]
+        fnam = self.write('db.o', odbfiles.binary(blocks))
+        want = dict((n, crc32c(odbfiles.payload(t, d))) for n, t, d in blocks)
+        code = ('import sys, threading, odbparser\n'
+                'out = []\n'
+                'ts = [threading.Thread(target=lambda: out.append(odbparser.verify(sys.argv[1])))\n'
+                '      for i in range(16)]\n'
+                'for t in ts: t.start()\n'
+                'for t in ts: t.join()\n'
+                'print(out)\n')
+        for i in range(5):
+            out = subprocess.check_output([sys.executable, '-c', code, fnam],
+                                          env=dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path)))
+            self.assertEqual(eval(out), [want] * 16)
+
+
+class FramingTest(odbfiles.TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.blocks = odbfiles.standard()
+        self.contents = odbfiles.binary(self.blocks)
+
+    def check_broken(self, contents, message):
+        fnam = self.write('bad.o', bytes(contents))
+        with self.assertRaisesRegex(odbparser.error, message):
+            odbparser.verify(fnam)
+        with self.assertRaisesRegex(odbparser.error, message):
+            odbparser.get(fnam, verify=True)
+
+    def test_sound(self):
+        fnam = self.write('db.o', self.contents)
+        self.assertBlocksEqual(odbparser.get(fnam, verify=True), self.blocks)
+        self.assertBlocksEqual(odbparser.get(fnam, verify=True, numpy=False), self.blocks)
+
+    def test_truncated(self):
+        for cut in (1, 4, 20, 112, len(self.contents) - 40):
+            self.check_broken(self.contents[:-cut], 'truncated or corrupt|broken datablock header')
+
+    def test_corrupt_marker(self):
+        contents = bytearray(self.contents)
+        contents[38] ^= 0x01		# leading marker of the first data record
+        self.check_broken(contents, r'datablock \.gs_real: data record at offset 38')
+        contents = bytearray(self.contents)
+        contents[0] ^= 0x10		# leading marker of the first header
+        self.check_broken(contents, 'broken datablock header at offset 0')
+
+    def test_wrong_size(self):
+        contents = odbfiles.header('.ints', 'I', 4) + odbfiles.record(struct.pack('>3i', 1, 2, 3))
+        self.check_broken(contents, r'\.ints: data record is 12 bytes, expected 16')
+
+    def test_negative_size(self):
+        for n in (-1, -3, -2**31):
+            contents = odbfiles.header('.ints', 'I', n) + odbfiles.record(b'')
+            self.check_broken(contents, r'datablock \.ints has invalid size %d' % n)
+
+    def test_unknown_type(self):
+        contents = raw('.what', 'Q', 2, b'12345678')
+        self.check_broken(contents, r"datablock \.what has unknown type 'Q'")
+
+    def test_formatted(self):
+        fnam = self.write('db.fo', odbfiles.formatted(self.blocks))
+        with self.assertRaisesRegex(odbparser.error, 'not a binary O file'):
+            odbparser.verify(fnam)
+        with self.assertRaisesRegex(odbparser.error, 'not a binary O file'):
+            odbparser.get(fnam, verify=True)
+        self.assertBlocksEqual(odbparser.get(fnam), self.blocks, places=4)
+
+    def test_missing(self):
+        with self.assertRaises(odbparser.error):
+            odbparser.verify(self.path('missing.o'))
+
+    def test_replaced_while_reading(self):
+        # a file that passes the checks, and then is replaced by a broken
+        # one before it is decoded, is not returned as checked
+        sound = self.contents
+        blocks = [(n, t, [x * 2 for x in d] if t in 'IR' else d) for n, t, d in self.blocks]
+        broken = bytearray(odbfiles.binary(blocks))
+        broken[-1] ^= 1
+        fnam = self.write('db.o', sound)
+        stop = threading.Event()
+
+        def replace():
+            i = 0
+            while not stop.is_set():
+                i += 1
+                os.rename(self.write('new.o', bytes(broken) if i % 2 else sound), fnam)
+
+        thread = threading.Thread(target=replace)
+        thread.start()
+        try:
+            for i in range(3000):
+                try:
+                    db = odbparser.get(fnam, verify=True)
+                except (odbparser.error, OSError):
+                    continue
+                self.assertEqual(db['.sam_integer'].tolist(), [1, 2, 3, -4, 5])
+        finally:
+            stop.set()
+            thread.join()
+
+
+if __name__ == '__main__':
+    unittest.main()